@@ -0,0 +1,47 @@
+#include "Fsm.h"
+#include "FsmTimer.h"
+
+/*
+ * Emits a 500 us pulse on the led pin once a second. The timeouts come
+ * from a hardware timer, so the machine does not check its timers on every
+ * run_machine() call. The transition itself still runs from loop(): the
+ * pulse ends at the first run_machine() call after the timer fires, so
+ * work in loop() between calls stretches it.
+ */
+
+#define LED_PIN 13
+
+State state_idle(&pulse_end, NULL, NULL);
+State state_pulse(&pulse_start, NULL, NULL);
+Fsm fsm(&state_idle);
+FsmTimer timer;
+
+void pulse_start()
+{
+  digitalWrite(LED_PIN, HIGH);
+}
+
+void pulse_end()
+{
+  digitalWrite(LED_PIN, LOW);
+}
+
+// standard arduino functions
+void setup()
+{
+  Serial.begin(9600);
+  pinMode(LED_PIN, OUTPUT);
+
+  fsm.add_timed_transition(&state_idle, &state_pulse, 1000, NULL);
+  fsm.add_fine_timed_transition(&state_pulse, &state_idle, 500, NULL);
+
+  if (!timer.begin(&fsm))
+    Serial.println("No hardware timer, polling instead");
+}
+
+void loop()
+{
+  // Only takes the timed transitions once the timer has fired. Keep loop()
+  // short; anything here delays the end of the pulse.
+  fsm.run_machine();
+}
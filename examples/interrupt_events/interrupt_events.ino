@@ -0,0 +1,49 @@
+// This example posts events from an interrupt handler. The handler only
+// puts the event in the machine's queue; the transition and its handlers
+// run later from loop() when run_machine() drains the queue.
+
+#include "Fsm.h"
+
+#define LED_PIN     13
+#define BUTTON_PIN  2
+
+//Events
+#define BUTTON_EVENT  0
+
+void led_off()
+{
+  digitalWrite(LED_PIN, LOW);
+}
+
+void led_on()
+{
+  digitalWrite(LED_PIN, HIGH);
+}
+
+State state_led_off(&led_off, NULL, NULL);
+State state_led_on(&led_on, NULL, NULL);
+Fsm fsm(&state_led_off);
+
+volatile int events[8];
+
+void on_button_press()
+{
+  fsm.post(BUTTON_EVENT);
+}
+
+void setup()
+{
+  pinMode(LED_PIN, OUTPUT);
+  pinMode(BUTTON_PIN, INPUT_PULLUP);
+
+  fsm.add_transition(&state_led_off, &state_led_on, BUTTON_EVENT, NULL);
+  fsm.add_transition(&state_led_on, &state_led_off, BUTTON_EVENT, NULL);
+  fsm.set_event_queue(events, 8);
+
+  attachInterrupt(digitalPinToInterrupt(BUTTON_PIN), on_button_press, FALLING);
+}
+
+void loop()
+{
+  fsm.run_machine();
+}
@@ -0,0 +1,23 @@
+// Generated by fsm_compile.py.
+
+#ifndef LIGHT_H
+#define LIGHT_H
+
+#define LIGHT_STATE_LIGHT_OFF 0
+#define LIGHT_STATE_LIGHT_ON 1
+#define LIGHT_NUM_STATES 2
+
+#define LIGHT_HANDLER_ON_TRANS_LIGHT_OFF_LIGHT_ON 0
+#define LIGHT_HANDLER_ON_TRANS_LIGHT_ON_LIGHT_OFF 1
+#define LIGHT_NUM_HANDLERS 2
+
+#define LIGHT_EVENT_FLIP_LIGHT_SWITCH 1
+
+const uint8_t LIGHT_IMAGE[41] PROGMEM = {
+  0x46, 0x53, 0x4d, 0x42, 0x02, 0x02, 0x02, 0x00, 0x02, 0x00, 0x01, 0x00,
+  0xff, 0x00, 0x00, 0x00, 0x00, 0xff, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x01, 0x00, 0x01, 0x00, 0xff, 0x01, 0x00, 0x00, 0x01, 0xff, 0x10, 0x27,
+  0x00, 0x00, 0x00, 0x01, 0x00,
+};
+
+#endif
@@ -0,0 +1,53 @@
+#include "Fsm.h"
+#include "light_switch.h"
+
+// The transitions come from light_switch.h, compiled from light_switch.fsm
+// by extras/tools/fsm_compile.py, instead of add_transition() calls.
+State state_light_off(on_light_off_enter, NULL, NULL);
+State state_light_on(on_light_on_enter, NULL, NULL);
+Fsm fsm(&state_light_off);
+
+// In the order the description declares them.
+State* states[LIGHT_NUM_STATES] = { &state_light_off, &state_light_on };
+void (* const handlers[LIGHT_NUM_HANDLERS])() = {
+  &on_trans_light_off_light_on,
+  &on_trans_light_on_light_off,
+};
+
+void on_light_on_enter()
+{
+  Serial.println("Entering LIGHT_ON");
+}
+
+void on_light_off_enter()
+{
+  Serial.println("Entering LIGHT_OFF");
+}
+
+void on_trans_light_on_light_off()
+{
+  Serial.println("Transitioning from LIGHT_ON to LIGHT_OFF");
+}
+
+void on_trans_light_off_light_on()
+{
+  Serial.println("Transitioning from LIGHT_OFF to LIGHT_ON");
+}
+
+// standard arduino functions
+void setup()
+{
+  Serial.begin(9600);
+
+  if (!fsm.load(LIGHT_IMAGE, sizeof(LIGHT_IMAGE), states, LIGHT_NUM_STATES,
+                handlers, LIGHT_NUM_HANDLERS, &FsmDefinition::read_progmem))
+    Serial.println("Bad machine image");
+}
+
+void loop()
+{
+  // The light switches itself off after 10 seconds
+  fsm.run_machine();
+  delay(3000);
+  fsm.trigger(LIGHT_EVENT_FLIP_LIGHT_SWITCH);
+}
@@ -2,7 +2,7 @@
 // multitasking on an arduino. Two LED's are turned on and off at irregular
 // intervals; the finite state machines take care of the transitions.
 
-#include "Fsm.h"
+#include "FsmScheduler.h"
 
 #define LED1_PIN 10
 #define LED2_PIN 11
@@ -36,6 +36,8 @@ State state_led2_off(&on_led2_off_enter, NULL, NULL);
 Fsm fsm_led1(&state_led1_off);
 Fsm fsm_led2(&state_led2_off);
 
+FsmScheduler scheduler;
+
 void setup() {
     Serial.begin(9600);
 
@@ -46,12 +48,17 @@ void setup() {
     fsm_led1.add_timed_transition(&state_led1_on, &state_led1_off, 3000, NULL);
     fsm_led2.add_timed_transition(&state_led2_off, &state_led2_on, 1000, NULL);
     fsm_led2.add_timed_transition(&state_led2_on, &state_led2_off, 2000, NULL);
+
+    scheduler.add(&fsm_led1);
+    scheduler.add(&fsm_led2);
 }
 
 
 void loop() {
-    fsm_led1.run_machine();
-    fsm_led2.run_machine();
-    delay(200);
+    scheduler.run();
+
+    // Nothing happens until the next timed transition is due, so wait
+    // exactly that long instead of polling.
+    delay(scheduler.ms_until_next_timeout());
 }
 
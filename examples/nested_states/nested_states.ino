@@ -0,0 +1,57 @@
+// This example nests the states of a motor in a "running" parent state.
+// The emergency stop transition is added once, from the parent, and is
+// taken from whichever child state is current.
+
+#include "Fsm.h"
+
+#define SPEED_UP  1
+#define SLOW_DOWN 2
+#define STOP      3
+#define RESET     4
+
+void on_running_exit()
+{
+  Serial.println("Motor stopped");
+}
+
+void on_slow_enter()
+{
+  Serial.println("Running slow");
+}
+
+void on_fast_enter()
+{
+  Serial.println("Running fast");
+}
+
+void on_stopped_enter()
+{
+  Serial.println("Emergency stop");
+}
+
+State state_running(NULL, NULL, &on_running_exit);
+State state_slow(&on_slow_enter, NULL, NULL, &state_running);
+State state_fast(&on_fast_enter, NULL, NULL, &state_running);
+State state_stopped(&on_stopped_enter, NULL, NULL);
+Fsm fsm(&state_slow);
+
+void setup()
+{
+  Serial.begin(9600);
+
+  fsm.add_transition(&state_slow, &state_fast, SPEED_UP, NULL);
+  fsm.add_transition(&state_fast, &state_slow, SLOW_DOWN, NULL);
+  fsm.add_transition(&state_running, &state_stopped, STOP, NULL);
+  fsm.add_transition(&state_stopped, &state_slow, RESET, NULL);
+  fsm.run_machine();
+}
+
+void loop()
+{
+  delay(1000);
+  fsm.trigger(SPEED_UP);
+  delay(1000);
+  fsm.trigger(STOP);
+  delay(1000);
+  fsm.trigger(RESET);
+}
@@ -0,0 +1,70 @@
+// This example shows one machine with two orthogonal regions. The first
+// region follows a button, the second blinks a LED on its own; both run
+// from a single Fsm and a single trigger() reaches both of them.
+
+#include "Fsm.h"
+
+#define BUTTON_PIN 2
+#define STATUS_LED_PIN 12
+#define BLINK_LED_PIN 13
+
+// Events
+#define BUTTON_PRESSED 1
+#define BUTTON_RELEASED 2
+
+void on_released_enter() {
+    digitalWrite(STATUS_LED_PIN, LOW);
+}
+
+void on_pressed_enter() {
+    digitalWrite(STATUS_LED_PIN, HIGH);
+}
+
+void on_blink_off_enter() {
+    digitalWrite(BLINK_LED_PIN, LOW);
+}
+
+void on_blink_on_enter() {
+    digitalWrite(BLINK_LED_PIN, HIGH);
+}
+
+// Region 1: the button.
+State state_released(&on_released_enter, NULL, NULL);
+State state_pressed(&on_pressed_enter, NULL, NULL);
+
+// Region 2: the blinking LED.
+State state_blink_off(&on_blink_off_enter, NULL, NULL);
+State state_blink_on(&on_blink_on_enter, NULL, NULL);
+
+Fsm fsm(&state_released);
+
+void setup() {
+    pinMode(BUTTON_PIN, INPUT_PULLUP);
+    pinMode(STATUS_LED_PIN, OUTPUT);
+    pinMode(BLINK_LED_PIN, OUTPUT);
+
+    fsm.add_region(&state_blink_off);
+
+    fsm.add_transition(&state_released, &state_pressed, BUTTON_PRESSED, NULL);
+    fsm.add_transition(&state_pressed, &state_released, BUTTON_RELEASED, NULL);
+
+    // Pressing the button also restarts the blink cycle.
+    fsm.add_transition(&state_blink_on, &state_blink_off, BUTTON_PRESSED,
+                       NULL);
+    fsm.add_timed_transition(&state_blink_off, &state_blink_on, 500, NULL);
+    fsm.add_timed_transition(&state_blink_on, &state_blink_off, 500, NULL);
+
+    fsm.compile();
+}
+
+
+void loop() {
+    static bool was_pressed = false;
+    bool pressed = digitalRead(BUTTON_PIN) == LOW;
+    if (pressed != was_pressed) {
+        fsm.trigger(pressed ? BUTTON_PRESSED : BUTTON_RELEASED);
+        was_pressed = pressed;
+    }
+
+    fsm.run_machine();
+}
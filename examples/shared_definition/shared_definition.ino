@@ -0,0 +1,58 @@
+// This example drives several output channels with one machine definition.
+// The states and transitions are stored once in an FsmDefinition; each
+// channel only keeps an FsmInstance with its current state and timer, and
+// passes its pin to the handlers through the context pointer.
+
+#include "Fsm.h"
+
+#define NUM_CHANNELS 4
+#define BUTTON_PIN 2
+
+// Events
+#define PULSE 1
+
+const int channel_pins[NUM_CHANNELS] = {8, 9, 10, 11};
+
+void on_pulse_enter(void* context) {
+    digitalWrite(*(const int*) context, HIGH);
+}
+
+void on_idle_enter(void* context) {
+    digitalWrite(*(const int*) context, LOW);
+}
+
+State state_idle(&on_idle_enter, NULL, NULL);
+State state_pulse(&on_pulse_enter, NULL, NULL);
+
+FsmDefinition channel(&state_idle);
+FsmInstance channels[NUM_CHANNELS];
+
+int next_channel = 0;
+
+void setup() {
+    pinMode(BUTTON_PIN, INPUT_PULLUP);
+
+    channel.add_transition(&state_idle, &state_pulse, PULSE, NULL);
+    channel.add_timed_transition(&state_pulse, &state_idle, 500, NULL);
+    channel.compile();
+
+    for (int i = 0; i < NUM_CHANNELS; ++i) {
+        pinMode(channel_pins[i], OUTPUT);
+        channels[i].set_definition(&channel);
+        channels[i].set_context((void*) &channel_pins[i]);
+    }
+}
+
+
+void loop() {
+    // Each button press pulses the next channel in turn.
+    if (digitalRead(BUTTON_PIN) == LOW) {
+        channels[next_channel].trigger(PULSE);
+        next_channel = (next_channel + 1) % NUM_CHANNELS;
+        delay(200);
+    }
+
+    unsigned long now = millis();
+    for (int i = 0; i < NUM_CHANNELS; ++i)
+        channels[i].run_machine(now);
+}
@@ -0,0 +1,52 @@
+// The light_switch example defined at compile time. The states and
+// transitions are template arguments, so the machine needs no heap and its
+// table lives in flash; only the current state is kept in RAM.
+
+#include "StaticFsm.h"
+
+#define FLIP_LIGHT_SWITCH 1
+
+// State ids are the positions in the States list below.
+#define LIGHT_OFF 0
+#define LIGHT_ON  1
+
+void on_light_on_enter()
+{
+  Serial.println("Entering LIGHT_ON");
+}
+
+void on_light_off_enter()
+{
+  Serial.println("Entering LIGHT_OFF");
+}
+
+void on_trans_light_off_light_on()
+{
+  Serial.println("Transitioning from LIGHT_OFF to LIGHT_ON");
+}
+
+typedef StaticStates<StaticState<&on_light_off_enter>,
+                     StaticState<&on_light_on_enter> > States;
+
+typedef TransitionTable<
+    StaticTransition<LIGHT_OFF, LIGHT_ON, FLIP_LIGHT_SWITCH,
+                     &on_trans_light_off_light_on>,
+    StaticTransition<LIGHT_ON, LIGHT_OFF, FLIP_LIGHT_SWITCH>,
+    // Switch the light off by itself after 10 seconds
+    StaticTimedTransition<LIGHT_ON, LIGHT_OFF, 10000> > Transitions;
+
+StaticFsm<States, Transitions, LIGHT_OFF> fsm;
+
+void setup()
+{
+  Serial.begin(9600);
+}
+
+void loop()
+{
+  fsm.run_machine();
+  delay(2000);
+  fsm.trigger(FLIP_LIGHT_SWITCH);
+  fsm.run_machine();
+  delay(2000);
+}
@@ -0,0 +1,41 @@
+// Minimal stand-in for the Arduino core, used to build the library for the
+// benchmarks. millis() and micros() return values the benchmark sets, so
+// timed transitions can be driven without real time passing.
+
+#ifndef FSM_BENCH_ARDUINO_H
+#define FSM_BENCH_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern unsigned long fake_millis;
+extern unsigned long fake_micros;
+
+inline unsigned long millis() { return fake_millis; }
+inline unsigned long micros() { return fake_micros; }
+
+// Enough of Print for FsmTrace::dump().
+class Print
+{
+public:
+  virtual size_t write(uint8_t c) = 0;
+
+  size_t write(const uint8_t* buffer, size_t size)
+  {
+    for (size_t i = 0; i < size; ++i)
+      write(buffer[i]);
+    return size;
+  }
+};
+
+#if defined(__AVR__)
+  #include <avr/interrupt.h>
+  inline void noInterrupts() { cli(); }
+  inline void interrupts() { sei(); }
+#else
+  inline void noInterrupts() {}
+  inline void interrupts() {}
+#endif
+
+#endif
@@ -0,0 +1,216 @@
+// Benchmarks for the core machine. Build and run with "make host", or
+// "make avr" to count ATmega328P cycles under simavr.
+//
+// On the host the results are nanoseconds per operation, on AVR they are
+// CPU cycles per operation.
+
+#include <stdio.h>
+
+#include "Fsm.h"
+
+unsigned long fake_millis = 1;
+unsigned long fake_micros = 1;
+
+#define NUM_STATES 40
+
+#if defined(__AVR__)
+  #define MAX_TRANSITIONS 128
+  #define REPEAT 64
+#else
+  #define MAX_TRANSITIONS 1024
+  #define REPEAT 100000
+#endif
+
+
+// ---------------------------------------------------------------------------
+// Clock
+// ---------------------------------------------------------------------------
+
+#if defined(__AVR__)
+
+#include <avr/io.h>
+#include <avr/sleep.h>
+
+static volatile uint16_t timer_overflows;
+
+ISR(TIMER1_OVF_vect)
+{
+  timer_overflows++;
+}
+
+static int uart_putchar(char c, FILE*)
+{
+  while (!(UCSR0A & _BV(UDRE0)))
+    ;
+  UDR0 = c;
+  return 0;
+}
+
+static FILE uart_output;
+
+static void clock_init()
+{
+  fdev_setup_stream(&uart_output, uart_putchar, NULL, _FDEV_SETUP_WRITE);
+  stdout = &uart_output;
+  UCSR0B = _BV(TXEN0);
+
+  // Timer1 counts CPU cycles, overflows extend it to 32 bits.
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+  TIMSK1 = _BV(TOIE1);
+  sei();
+}
+
+static uint32_t clock_now()
+{
+  cli();
+  uint16_t low = TCNT1;
+  uint16_t high = timer_overflows;
+  if ((TIFR1 & _BV(TOV1)) && low < 0x8000)
+    high++;
+  sei();
+  return ((uint32_t) high << 16) | low;
+}
+
+static void clock_exit()
+{
+  // simavr stops when the CPU sleeps with interrupts disabled.
+  cli();
+  sleep_cpu();
+}
+
+#define UNIT "cycles"
+
+#else
+
+#include <chrono>
+
+static void clock_init() {}
+
+static uint32_t clock_now()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(
+      steady_clock::now().time_since_epoch()).count();
+}
+
+static void clock_exit() {}
+
+#define UNIT "ns"
+
+#endif
+
+
+// ---------------------------------------------------------------------------
+// Machines
+// ---------------------------------------------------------------------------
+
+#define S State(NULL, NULL, NULL)
+#define S10 S, S, S, S, S, S, S, S, S, S
+
+static State states[NUM_STATES] = { S10, S10, S10, S10 };
+
+static volatile int sink;
+
+static void on_transition()
+{
+  sink++;
+}
+
+// Spread the transitions over all states, num / NUM_STATES events each.
+static void add_transitions(Fsm& fsm, int num)
+{
+  for (int i = 0; i < num; ++i)
+  {
+    fsm.add_transition(&states[i % NUM_STATES],
+                       &states[(i * 7 + 3) % NUM_STATES],
+                       i / NUM_STATES, &on_transition);
+  }
+}
+
+
+// ---------------------------------------------------------------------------
+// Benchmarks
+// ---------------------------------------------------------------------------
+
+static void bench_trigger(int num, bool compiled)
+{
+  Fsm fsm(&states[0]);
+  fsm.reserve(num);
+  add_transitions(fsm, num);
+  if (compiled)
+    fsm.compile();
+  fsm.run_machine();
+
+  // Mix of matched and unmatched events.
+  int events = num / NUM_STATES + 1;
+  uint32_t start = clock_now();
+  for (long i = 0; i < REPEAT; ++i)
+    fsm.trigger(i % events);
+  uint32_t elapsed = clock_now() - start;
+
+  printf("trigger %-8s %5d transitions: %6lu %s/event\n",
+         compiled ? "compiled" : "linear", num,
+         (unsigned long) (elapsed / REPEAT), UNIT);
+}
+
+static void bench_timed_tick(int num)
+{
+  Fsm fsm(&states[0]);
+  fsm.reserve(0, num);
+  for (int i = 0; i < num; ++i)
+    fsm.add_timed_transition(&states[i % NUM_STATES],
+                             &states[(i + 1) % NUM_STATES],
+                             1000 + i, NULL);
+  fsm.compile();
+  fsm.run_machine();
+
+  // No deadline passes, so this is the cost of an idle tick.
+  uint32_t start = clock_now();
+  for (long i = 0; i < REPEAT; ++i)
+    fsm.run_machine();
+  uint32_t elapsed = clock_now() - start;
+
+  printf("run_machine      %5d timed:       %6lu %s/tick\n",
+         num, (unsigned long) (elapsed / REPEAT), UNIT);
+}
+
+static void bench_setup(int num, bool reserve)
+{
+  uint32_t elapsed = 0;
+  int rounds = REPEAT / num + 1;
+  for (int r = 0; r < rounds; ++r)
+  {
+    Fsm fsm(&states[0]);
+    uint32_t start = clock_now();
+    if (reserve)
+      fsm.reserve(num);
+    add_transitions(fsm, num);
+    elapsed += clock_now() - start;
+  }
+
+  printf("add_transition %-8s %5d:       %6lu %s/transition\n",
+         reserve ? "reserved" : "growing", num,
+         (unsigned long) (elapsed / ((uint32_t) rounds * num)), UNIT);
+}
+
+int main()
+{
+  clock_init();
+
+  for (int num = 8; num <= MAX_TRANSITIONS; num *= 2)
+  {
+    bench_trigger(num, false);
+    bench_trigger(num, true);
+  }
+  for (int num = 8; num <= MAX_TRANSITIONS; num *= 2)
+    bench_timed_tick(num);
+  for (int num = 8; num <= MAX_TRANSITIONS; num *= 2)
+  {
+    bench_setup(num, false);
+    bench_setup(num, true);
+  }
+
+  clock_exit();
+  return 0;
+}
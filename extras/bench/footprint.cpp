@@ -0,0 +1,135 @@
+// Representative machines for the footprint report, built with "make
+// footprint". FOOTPRINT_MACHINE picks one; the empty machine is the
+// baseline the others are measured against.
+
+#include "FsmScheduler.h"
+
+unsigned long fake_millis = 1;
+unsigned long fake_micros = 1;
+
+#define FOOTPRINT_EMPTY 0
+#define FOOTPRINT_LIGHT_SWITCH 1
+#define FOOTPRINT_TIMED_SWITCHOFF 2
+#define FOOTPRINT_MULTITASKING 3
+
+#ifndef FOOTPRINT_MACHINE
+#define FOOTPRINT_MACHINE FOOTPRINT_EMPTY
+#endif
+
+// Handlers touch this so they are not optimized away.
+volatile uint8_t footprint_output;
+
+static void set_low()
+{
+  footprint_output = 0;
+}
+
+static void set_high()
+{
+  footprint_output = 1;
+}
+
+
+#if FOOTPRINT_MACHINE == FOOTPRINT_LIGHT_SWITCH
+
+// examples/light_switch: two states flipped by an event.
+#define FLIP_LIGHT_SWITCH 1
+
+State state_light_on(&set_high, NULL, NULL);
+State state_light_off(&set_low, NULL, NULL);
+Fsm fsm(&state_light_off);
+
+static void setup()
+{
+  fsm.add_transition(&state_light_on, &state_light_off, FLIP_LIGHT_SWITCH,
+                     NULL);
+  fsm.add_transition(&state_light_off, &state_light_on, FLIP_LIGHT_SWITCH,
+                     NULL);
+}
+
+static void loop()
+{
+  fsm.trigger(FLIP_LIGHT_SWITCH);
+}
+
+#elif FOOTPRINT_MACHINE == FOOTPRINT_TIMED_SWITCHOFF
+
+// examples/timed_switchoff: a button turns the led on, a timed transition
+// or the button turns it off again.
+#define BUTTON_EVENT 0
+
+static void check_button();
+
+State state_led_off(&set_low, &check_button, NULL);
+State state_led_on(&set_high, &check_button, NULL);
+Fsm fsm(&state_led_off);
+
+static void check_button()
+{
+  if (footprint_output == 2)
+    fsm.trigger(BUTTON_EVENT);
+}
+
+static void setup()
+{
+  fsm.add_transition(&state_led_off, &state_led_on, BUTTON_EVENT, NULL);
+  fsm.add_timed_transition(&state_led_on, &state_led_off, 3000, NULL);
+  fsm.add_transition(&state_led_on, &state_led_off, BUTTON_EVENT, NULL);
+}
+
+static void loop()
+{
+  fsm.run_machine();
+}
+
+#elif FOOTPRINT_MACHINE == FOOTPRINT_MULTITASKING
+
+// examples/multitasking: two blinking leds under a scheduler.
+State state_led1_on(&set_high, NULL, NULL);
+State state_led1_off(&set_low, NULL, NULL);
+State state_led2_on(&set_high, NULL, NULL);
+State state_led2_off(&set_low, NULL, NULL);
+
+Fsm fsm_led1(&state_led1_off);
+Fsm fsm_led2(&state_led2_off);
+
+FsmScheduler scheduler;
+
+static void setup()
+{
+  fsm_led1.add_timed_transition(&state_led1_off, &state_led1_on, 1000, NULL);
+  fsm_led1.add_timed_transition(&state_led1_on, &state_led1_off, 3000, NULL);
+  fsm_led2.add_timed_transition(&state_led2_off, &state_led2_on, 1000, NULL);
+  fsm_led2.add_timed_transition(&state_led2_on, &state_led2_off, 2000, NULL);
+
+  scheduler.add(&fsm_led1);
+  scheduler.add(&fsm_led2);
+}
+
+static void loop()
+{
+  scheduler.run();
+  fake_millis += scheduler.ms_until_next_timeout();
+}
+
+#else
+
+static void setup()
+{
+  set_high();
+}
+
+static void loop()
+{
+  set_low();
+}
+
+#endif
+
+
+int main()
+{
+  setup();
+  for (;;)
+    loop();
+}
@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+# This file is part of arduino-fsm.
+#
+# arduino-fsm is free software: you can redistribute it and/or modify it under
+# the terms of the GNU Lesser General Public License as published by the Free
+# Software Foundation, either version 3 of the License, or (at your option)
+# any later version.
+#
+# arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+# for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Report the flash and RAM the library costs, per machine and feature.
+
+Every configuration below is built the way the Arduino IDE builds a sketch:
+the library is compiled with -Os and -flto and linked with --gc-sections.
+Like the IDE, the objects are put in an archive only when library.properties
+sets dot_a_linkage=true, so that files a sketch does not use are left out;
+otherwise every object is linked. The machines in footprint.cpp are sized with size(1) and reported against an empty sketch,
+so the numbers are what the library adds. The size of each library type is
+read from footprint_sizes.cpp with nm(1).
+
+    footprint.py                    # ATmega328P, needs avr-gcc
+    footprint.py --cxx g++ --size size --nm nm --mcu ""
+
+A machine that does not build in a configuration, e.g. one with timed
+transitions under FSM_MINIMAL, is shown as "-".
+"""
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+LIB = os.path.normpath(os.path.join(HERE, "..", "..", "src"))
+PROPERTIES = os.path.normpath(os.path.join(HERE, "..", "..",
+                                          "library.properties"))
+# ConcurrentFsm needs FreeRTOS.
+SOURCES = sorted(name for name in os.listdir(LIB)
+                 if name.endswith(".cpp") and name != "ConcurrentFsm.cpp")
+
+# What each configuration changes from the default build.
+CONFIGS = [
+    ("default", []),
+    ("FSM_MINIMAL", ["-DFSM_MINIMAL=1"]),
+    ("no timed transitions", ["-DFSM_TIMED_TRANSITIONS=0"]),
+    ("no on_state", ["-DFSM_ON_STATE=0"]),
+    ("no fine timers", ["-DFSM_FINE_TIMERS=0"]),
+    ("no deferred events", ["-DFSM_DEFERRED_EVENTS=0"]),
+    ("int8_t events", ["-DFSM_EVENT_TYPE=int8_t"]),
+    ("no dense table", ["-DFSM_DENSE_TABLE_SIZE=0"]),
+    ("instrumentation", ["-DFSM_INSTRUMENTATION=1"]),
+    ("profiling", ["-DFSM_PROFILING=1"]),
+]
+
+# FOOTPRINT_MACHINE values in footprint.cpp, after the empty baseline 0.
+MACHINES = [("light_switch", 1), ("timed_switchoff", 2), ("multitasking", 3)]
+
+TYPES = ["State", "Transition", "TimedTransition", "StateSlot", "Callback",
+         "FsmDefinition", "FsmInstance", "Fsm"]
+
+
+def archived():
+    """Whether the IDE links the library from an archive."""
+    with open(PROPERTIES) as properties:
+        for line in properties:
+            key, _, value = line.strip().partition("=")
+            if key == "dot_a_linkage":
+                return value == "true"
+    return False
+
+
+class Toolchain(object):
+    def __init__(self, args, work):
+        self.args = args
+        self.work = work
+        self.flags = ["-std=gnu++11", "-Os", "-flto", "-ffunction-sections",
+                      "-fdata-sections", "-DARDUINO=100", "-I" + HERE,
+                      "-I" + LIB]
+        if args.mcu:
+            self.flags += ["-mmcu=" + args.mcu,
+                           "-DF_CPU=%sUL" % args.f_cpu]
+
+    def run(self, command):
+        result = subprocess.run(command, stdout=subprocess.PIPE,
+                                stderr=subprocess.PIPE,
+                                universal_newlines=True)
+        return result.returncode == 0, result.stdout
+
+    def compile(self, source, output, defines, lto=True):
+        flags = [flag for flag in self.flags if lto or flag != "-flto"]
+        return self.run([self.args.cxx] + flags + defines +
+                        ["-c", source, "-o", output])[0]
+
+    def library(self, name, defines):
+        """Build the library for a configuration, as a list of what to link."""
+        objects = []
+        for source in SOURCES:
+            output = os.path.join(self.work, "%s_%s.o" % (name, source[:-4]))
+            if not self.compile(os.path.join(LIB, source), output, defines):
+                return None
+            objects.append(output)
+        if not self.args.archive:
+            return objects
+        archive = os.path.join(self.work, name + ".a")
+        if os.path.exists(archive):
+            os.remove(archive)
+        if not self.run([self.args.ar, "rcs", archive] + objects)[0]:
+            return None
+        return [archive]
+
+    def machine(self, name, number, library, defines):
+        """Return (text, data, bss) of a machine, or None."""
+        base = os.path.join(self.work, "%s_%d" % (name, number))
+        if not self.compile(os.path.join(HERE, "footprint.cpp"), base + ".o",
+                            defines + ["-DFOOTPRINT_MACHINE=%d" % number]):
+            return None
+        ok, _ = self.run([self.args.cxx] + self.flags +
+                         ["-Wl,--gc-sections", base + ".o"] + library +
+                         ["-o", base + ".elf"])
+        if not ok:
+            return None
+        ok, output = self.run([self.args.size, base + ".elf"])
+        if not ok:
+            return None
+        text, data, bss = output.splitlines()[1].split()[:3]
+        return int(text), int(data), int(bss)
+
+    def sizes(self, name, defines):
+        """Return the size of every type in TYPES, or None."""
+        output = os.path.join(self.work, name + "_sizes.o")
+        # LTO objects carry no symbols for nm to size.
+        if not self.compile(os.path.join(HERE, "footprint_sizes.cpp"),
+                            output, defines, lto=False):
+            return None
+        ok, symbols = self.run([self.args.nm, "-S", output])
+        if not ok:
+            return None
+        sizes = {}
+        for line in symbols.splitlines():
+            words = line.split()
+            if len(words) == 4 and words[3].startswith("footprint_size_"):
+                sizes[words[3][len("footprint_size_"):]] = int(words[1], 16)
+        return sizes
+
+
+def cell(value):
+    return "-" if value is None else str(value)
+
+
+def report(toolchain, out):
+    results = []
+    for index, (config, defines) in enumerate(CONFIGS):
+        name = "config%d" % index
+        library = toolchain.library(name, defines)
+        if library is None:
+            raise RuntimeError("the library does not build with %s"
+                               % " ".join(defines))
+        # Without the library: an object the IDE links unconditionally,
+        # such as an interrupt vector, counts against the machines.
+        baseline = toolchain.machine(name, 0, [], defines)
+        if baseline is None:
+            raise RuntimeError("the empty sketch does not build")
+        machines = []
+        for _, number in MACHINES:
+            size = toolchain.machine(name, number, library, defines)
+            if size is not None:
+                size = tuple(a - b for a, b in zip(size, baseline))
+            machines.append(size)
+        results.append((config, machines, toolchain.sizes(name, defines)))
+
+    out.write("Bytes the library adds to an empty sketch, text/data/bss")
+    out.write(" (%s):\n\n" % ("archived" if toolchain.args.archive
+                               else "every object linked"))
+    width = max(len(config) for config, _ in CONFIGS)
+    out.write("%-*s" % (width, ""))
+    for machine, _ in MACHINES:
+        out.write("  %18s" % machine)
+    out.write("\n")
+    default = results[0][1]
+    for config, machines, _ in results:
+        out.write("%-*s" % (width, config))
+        for size in machines:
+            if size is None:
+                out.write("  %18s" % "-")
+            else:
+                out.write("  %18s" % "/".join(str(part) for part in size))
+        out.write("\n")
+
+        if config != results[0][0]:
+            out.write("%-*s" % (width, "  vs default"))
+            for index, size in enumerate(machines):
+                if size is None or default[index] is None:
+                    out.write("  %18s" % "-")
+                else:
+                    out.write("  %18s" % "/".join(
+                        "%+d" % (a - b) for a, b in zip(size,
+                                                        default[index])))
+            out.write("\n")
+
+    out.write("\nBytes per object:\n\n")
+    out.write("%-*s" % (width, ""))
+    for name in TYPES:
+        out.write(" %*s" % (max(len(name), 4), name))
+    out.write("\n")
+    for config, _, sizes in results:
+        out.write("%-*s" % (width, config))
+        for name in TYPES:
+            out.write(" %*s" % (max(len(name), 4),
+                                cell(sizes.get(name) if sizes else None)))
+        out.write("\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--cxx", default="avr-g++")
+    parser.add_argument("--ar", default=None,
+                        help="archiver, avr-gcc-ar with avr-g++, else gcc-ar")
+    parser.add_argument("--size", default="avr-size")
+    parser.add_argument("--nm", default="avr-nm")
+    parser.add_argument("--mcu", default="atmega328p",
+                        help="empty to build for the host")
+    parser.add_argument("--f-cpu", default="16000000")
+    args = parser.parse_args()
+    args.archive = archived()
+    if args.ar is None:
+        args.ar = "avr-gcc-ar" if args.cxx.startswith("avr-") else "gcc-ar"
+
+    work = tempfile.mkdtemp(prefix="fsm_footprint_")
+    try:
+        report(Toolchain(args, work), sys.stdout)
+    except (OSError, RuntimeError) as error:
+        sys.stderr.write("footprint: %s\n" % error)
+        return 1
+    finally:
+        shutil.rmtree(work)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
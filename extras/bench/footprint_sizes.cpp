@@ -0,0 +1,16 @@
+// One object per library type, sized like the type, for the footprint
+// report to read back with nm. Only compiled, never linked.
+
+#include "Fsm.h"
+
+#define FOOTPRINT_SIZE(name, type) \
+  extern const uint8_t footprint_size_##name[sizeof(type)] = { 0 }
+
+FOOTPRINT_SIZE(State, State);
+FOOTPRINT_SIZE(Transition, FsmDefinition::Transition);
+FOOTPRINT_SIZE(TimedTransition, FsmDefinition::TimedTransition);
+FOOTPRINT_SIZE(StateSlot, FsmDefinition::StateSlot);
+FOOTPRINT_SIZE(Callback, FsmDefinition::Callback);
+FOOTPRINT_SIZE(FsmDefinition, FsmDefinition);
+FOOTPRINT_SIZE(FsmInstance, FsmInstance);
+FOOTPRINT_SIZE(Fsm, Fsm);
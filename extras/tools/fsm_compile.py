@@ -0,0 +1,342 @@
+#!/usr/bin/env python3
+# This file is part of arduino-fsm.
+#
+# arduino-fsm is free software: you can redistribute it and/or modify it under
+# the terms of the GNU Lesser General Public License as published by the Free
+# Software Foundation, either version 3 of the License, or (at your option)
+# any later version.
+#
+# arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+# for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Compile a machine description into an image for FsmDefinition::load().
+
+The description lists one declaration per line; '#' starts a comment.
+
+    state off                   # the first state is the initial state
+    state on
+    state blinking parent=on
+    handler on_flip             # transition handler or guard
+    handler is_armed context    # takes the machine's context pointer
+    event FLIP 1
+    transition off on FLIP on_flip
+    transition on off FLIP guard=is_armed
+    timed blinking off 3000 on_flip
+    timed_fine on off 250           # FSM_FINE_CLOCK ticks, microseconds
+
+States and handlers are numbered in the order they are declared; the sketch
+passes its State and handler tables to load() in the same order. Events may
+be given by name or number. Transitions for the same state and event are
+tried in the order they are listed, as with add_transition().
+
+    fsm_compile.py machine.fsm -o machine.bin
+    fsm_compile.py machine.fsm --header machine.h --name MACHINE
+
+The header holds the image as a PROGMEM array and defines the state, handler
+and event numbers.
+
+Transitions that are never taken, states that cannot be reached and states
+with the same transitions are reported on stderr. --optimize drops the
+first two from the image like FsmDefinition::optimize(); states are not
+merged, since whether they are equivalent also depends on their handlers,
+which only the sketch knows.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"FSMB"
+VERSION = 2
+HEADER = struct.Struct("<4sBBBxHH")
+STATE = struct.Struct("<BHH")
+TRANSITION = struct.Struct("<hBBB")
+TIMED_TRANSITION = struct.Struct("<IBBB")
+
+TIMED_FINE = 1
+
+NO_STATE = 0xFF
+NO_CALLBACK = 0xFF
+
+
+class Machine(object):
+    def __init__(self):
+        self.states = []
+        self.parents = {}
+        self.handlers = []
+        self.context = set()
+        self.events = {}
+        self.transitions = []
+        self.timed_transitions = []
+
+
+def parse(lines):
+    """Return the Machine described by the given lines."""
+    machine = Machine()
+    for number, line in enumerate(lines, 1):
+        words = line.split("#", 1)[0].split()
+        if not words:
+            continue
+        try:
+            parse_line(machine, words)
+        except ValueError as error:
+            raise ValueError("line %d: %s" % (number, error))
+    if not machine.states:
+        raise ValueError("no states declared")
+    return machine
+
+
+def parse_line(machine, words):
+    kind, args = words[0], words[1:]
+    options = dict(arg.split("=", 1) for arg in args if "=" in arg)
+    args = [arg for arg in args if "=" not in arg]
+
+    if kind == "state" and len(args) == 1:
+        declare(machine.states, args[0], "state")
+        if "parent" in options:
+            machine.parents[args[0]] = options["parent"]
+    elif kind == "handler" and len(args) in (1, 2):
+        declare(machine.handlers, args[0], "handler")
+        if args[1:] == ["context"]:
+            machine.context.add(args[0])
+        elif args[1:]:
+            raise ValueError("unknown handler flag %s" % args[1])
+    elif kind == "event" and len(args) == 2:
+        machine.events[args[0]] = int(args[1], 0)
+    elif kind == "transition" and len(args) in (3, 4):
+        machine.transitions.append((args[0], args[1], args[2],
+                                    args[3] if len(args) == 4 else None,
+                                    options.get("guard")))
+    elif kind in ("timed", "timed_fine") and len(args) in (3, 4):
+        machine.timed_transitions.append((args[0], args[1],
+                                          int(args[2], 0),
+                                          args[3] if len(args) == 4
+                                          else None,
+                                          kind == "timed_fine"))
+    else:
+        raise ValueError("cannot parse '%s'" % " ".join(words))
+
+
+def declare(names, name, what):
+    if name in names:
+        raise ValueError("%s %s declared twice" % (what, name))
+    names.append(name)
+
+
+def lookup(names, name, what):
+    if name not in names:
+        raise ValueError("undeclared %s %s" % (what, name))
+    return names.index(name)
+
+
+def shadowed(machine):
+    """Return the transitions and timed transitions that are never taken.
+
+    An earlier transition for the same state and event wins unless its guard
+    can fail where the later one's passes, and only the shortest timed
+    transition of a state on each clock fires.
+    """
+    dead = []
+    for index, (source, _, name, _, guard) in enumerate(machine.transitions):
+        for other in machine.transitions[:index]:
+            if (other[0] == source and other[2] == name and
+                    other[4] in (None, guard)):
+                dead.append(machine.transitions[index])
+                break
+
+    shortest = {}
+    for transition in machine.timed_transitions:
+        key = (transition[0], transition[4])
+        if key not in shortest or transition[2] < shortest[key][2]:
+            shortest[key] = transition
+    live = set(id(transition) for transition in shortest.values())
+    dead += [transition for transition in machine.timed_transitions
+             if id(transition) not in live]
+    return dead
+
+
+def reachable(machine, dead=()):
+    """Return the states reachable from the initial state."""
+    dead = set(id(transition) for transition in dead)
+    found = set()
+    pending = [machine.states[0]]
+    while pending:
+        state = pending.pop()
+        # Being in a state means being in all its parents too.
+        while state is not None and state not in found:
+            found.add(state)
+            for transition in machine.transitions + machine.timed_transitions:
+                if transition[0] == state and id(transition) not in dead:
+                    pending.append(transition[1])
+            state = machine.parents.get(state)
+    return found
+
+
+def similar(machine, dead=()):
+    """Return groups of states whose transitions are all the same."""
+    dead = set(id(transition) for transition in dead)
+    groups = {}
+    for state in machine.states:
+        edges = tuple(transition[1:]
+                      for transition in machine.transitions
+                      + machine.timed_transitions
+                      if transition[0] == state and id(transition) not in dead)
+        key = (machine.parents.get(state), edges)
+        if state not in machine.parents.values() and edges:
+            groups.setdefault(key, []).append(state)
+    return [group for group in groups.values() if len(group) > 1]
+
+
+def report(machine, out):
+    """Write what validate() would find to out."""
+    dead = shadowed(machine)
+    found = reachable(machine, dead)
+    for transition in dead:
+        timed = transition in machine.timed_transitions
+        if not timed:
+            words = ["transition"]
+        else:
+            words = ["timed_fine" if transition[4] else "timed"]
+        words += [str(part) for part in transition[:4] if part is not None]
+        if not timed and transition[4] is not None:
+            words.append("guard=" + transition[4])
+        out.write("never taken: %s\n" % " ".join(words))
+    for state in machine.states:
+        if state not in found:
+            out.write("unreachable: state %s\n" % state)
+    for group in similar(machine, dead):
+        out.write("same transitions: states %s\n" % ", ".join(group))
+
+
+def optimize(machine):
+    """Drop the transitions that are never taken or cannot be reached."""
+    dead = shadowed(machine)
+    found = reachable(machine, dead)
+    dead = set(id(transition) for transition in dead)
+    machine.transitions = [t for t in machine.transitions
+                           if id(t) not in dead and t[0] in found]
+    machine.timed_transitions = [t for t in machine.timed_transitions
+                                 if id(t) not in dead and t[0] in found]
+
+
+def encode(machine):
+    """Return the image bytes for the machine."""
+    states = machine.states
+    handlers = machine.handlers
+    if len(states) >= NO_STATE:
+        raise ValueError("too many states")
+    if len(handlers) >= NO_CALLBACK:
+        raise ValueError("too many handlers")
+
+    def handler(name):
+        return NO_CALLBACK if name is None else lookup(handlers, name,
+                                                       "handler")
+
+    def event(name):
+        value = machine.events.get(name)
+        if value is None:
+            value = int(name, 0)
+        if not -0x8000 <= value < 0x8000:
+            raise ValueError("event %s does not fit 16 bits" % name)
+        return value
+
+    # Group by state and sort by event, keeping the listed order for ties
+    # like FsmDefinition::compile().
+    transitions = sorted(
+        ((lookup(states, source, "state"), event(name),
+          lookup(states, target, "state"), handler(on_transition),
+          handler(guard))
+         for source, target, name, on_transition, guard
+         in machine.transitions),
+        key=lambda transition: transition[:2])
+    timed_transitions = sorted(
+        ((lookup(states, source, "state"), interval,
+          lookup(states, target, "state"), handler(on_transition),
+          TIMED_FINE if fine else 0)
+         for source, target, interval, on_transition, fine
+         in machine.timed_transitions),
+        key=lambda transition: transition[0])
+
+    data = bytearray(HEADER.pack(MAGIC, VERSION, len(states), len(handlers),
+                                 len(transitions), len(timed_transitions)))
+    for index, name in enumerate(states):
+        parent = machine.parents.get(name)
+        data += STATE.pack(
+            NO_STATE if parent is None else lookup(states, parent, "state"),
+            sum(1 for t in transitions if t[0] < index),
+            sum(1 for t in timed_transitions if t[0] < index))
+    for name in handlers:
+        data.append(1 if name in machine.context else 0)
+    for source, value, target, on_transition, guard in transitions:
+        data += TRANSITION.pack(value, target, on_transition, guard)
+    for source, interval, target, on_transition, flags in timed_transitions:
+        data += TIMED_TRANSITION.pack(interval, target, on_transition, flags)
+    return bytes(data)
+
+
+def header(machine, image, name):
+    """Return a C header holding the image and the machine's numbers."""
+    lines = ["// Generated by fsm_compile.py.", "",
+             "#ifndef %s_H" % name, "#define %s_H" % name, ""]
+    for prefix, names in (("STATE", machine.states),
+                          ("HANDLER", machine.handlers)):
+        for index, item in enumerate(names):
+            lines.append("#define %s_%s_%s %d" % (name, prefix, item.upper(),
+                                                   index))
+        lines.append("#define %s_NUM_%sS %d" % (name, prefix, len(names)))
+        lines.append("")
+    for item, value in sorted(machine.events.items(), key=lambda e: e[1]):
+        lines.append("#define %s_EVENT_%s %d" % (name, item.upper(), value))
+    if machine.events:
+        lines.append("")
+
+    lines.append("const uint8_t %s_IMAGE[%d] PROGMEM = {" % (name, len(image)))
+    for start in range(0, len(image), 12):
+        chunk = image[start:start + 12]
+        lines.append("  " + ", ".join("0x%02x" % byte for byte in chunk) + ",")
+    lines += ["};", "", "#endif", ""]
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("input", help="machine description")
+    parser.add_argument("-o", "--output", help="write the binary image")
+    parser.add_argument("--header", help="write a C header with the image")
+    parser.add_argument("--name", default="FSM",
+                        help="prefix for the names in the header")
+    parser.add_argument("--optimize", action="store_true",
+                        help="leave out transitions that are never taken")
+    args = parser.parse_args()
+
+    try:
+        with open(args.input) as source:
+            machine = parse(source)
+        report(machine, sys.stderr)
+        if args.optimize:
+            optimize(machine)
+        image = encode(machine)
+    except (IOError, ValueError) as error:
+        sys.stderr.write("%s: %s\n" % (args.input, error))
+        return 1
+
+    if args.output:
+        with open(args.output, "wb") as out:
+            out.write(image)
+    if args.header:
+        with open(args.header, "w") as out:
+            out.write(header(machine, image, args.name))
+    if not args.output and not args.header:
+        sys.stdout.write("%d states, %d transitions, %d timed, %d bytes\n"
+                         % (len(machine.states), len(machine.transitions),
+                            len(machine.timed_transitions), len(image)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
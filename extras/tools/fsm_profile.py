@@ -0,0 +1,258 @@
+#!/usr/bin/env python3
+# This file is part of arduino-fsm.
+#
+# arduino-fsm is free software: you can redistribute it and/or modify it under
+# the terms of the GNU Lesser General Public License as published by the Free
+# Software Foundation, either version 3 of the License, or (at your option)
+# any later version.
+#
+# arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+# for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Report on a dispatch profile written by FsmProfile::dump().
+
+The input is a raw capture of the bytes the sketch wrote, e.g. saved from
+the serial port. Anything before the "FSMP" header is skipped, so the dump
+may follow other output.
+
+    fsm_profile.py capture.bin --states off,on --events FLIP,RESET
+
+The report lists the transitions by how often they fired with their
+latency, the (state, event) pairs that arrived without a matching
+transition, transitions listed behind a rarely taken one for the same state
+and event, and whether the dense (state, event) table would pay off.
+Latencies are from the event being dispatched until the target's on_enter()
+handlers have run, given as the upper bound of their bucket.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"FSMP"
+VERSION = 1
+HEADER = struct.Struct("<4sBBBBHHHH")
+TRANSITION = struct.Struct("<BBh")
+CELL = struct.Struct("<HH")
+
+# Bucket 0 holds latencies below FIRST_BOUND microseconds, every further
+# bucket doubles the bound and the last one is open ended.
+FIRST_BOUND = 8
+
+class Profile(object):
+    def __init__(self):
+        self.dense = False
+        self.dense_table_size = 0
+        self.num_states = 0
+        self.num_events = 0
+        self.other_events = 0
+        # (from, to, event, buckets) in the order of the compiled table.
+        self.transitions = []
+        # cells[state][event] is (arrivals, unmatched).
+        self.cells = []
+
+
+def decode(data):
+    """Return the Profile in the capture."""
+    start = data.find(MAGIC)
+    if start < 0:
+        raise ValueError("no FSMP header found")
+
+    fields = HEADER.unpack_from(data, start)
+    (magic, version, num_buckets, num_states, dense, dense_table_size,
+     num_events, num_transitions, other_events) = fields
+    if version != VERSION:
+        raise ValueError("unsupported profile version %d" % version)
+
+    histogram = struct.Struct("<%dH" % num_buckets)
+    size = (HEADER.size
+            + num_transitions * (TRANSITION.size + histogram.size)
+            + num_states * num_events * CELL.size)
+    if len(data) < start + size:
+        raise ValueError("profile truncated: expected %d bytes" % size)
+
+    profile = Profile()
+    profile.dense = bool(dense)
+    profile.dense_table_size = dense_table_size
+    profile.num_states = num_states
+    profile.num_events = num_events
+    profile.other_events = other_events
+    offset = start + HEADER.size
+    for _ in range(num_transitions):
+        state_from, state_to, event = TRANSITION.unpack_from(data, offset)
+        offset += TRANSITION.size
+        buckets = histogram.unpack_from(data, offset)
+        offset += histogram.size
+        profile.transitions.append((state_from, state_to, event, buckets))
+    for _ in range(num_states):
+        row = []
+        for _ in range(num_events):
+            row.append(CELL.unpack_from(data, offset))
+            offset += CELL.size
+        profile.cells.append(row)
+    return profile
+
+
+def bound(bucket, num_buckets):
+    """Return the label of a latency bucket."""
+    if bucket == num_buckets - 1:
+        return ">=%dus" % (FIRST_BOUND << (bucket - 1))
+    return "<%dus" % (FIRST_BOUND << bucket)
+
+
+def percentile(buckets, fraction):
+    """Return the bucket holding the given fraction of the samples."""
+    total = sum(buckets)
+    running = 0
+    for index, count in enumerate(buckets):
+        running += count
+        if running >= fraction * total:
+            return index
+    return len(buckets) - 1
+
+
+def report(profile, states, events, out):
+    def state_name(state):
+        return states[state] if state < len(states) else str(state)
+
+    def event_name(event):
+        if 0 <= event < len(events):
+            return events[event]
+        return str(event)
+
+    out.write("Transitions by count:\n\n")
+    fired = [(sum(t[3]), index, t) for index, t in
+             enumerate(profile.transitions)]
+    fired.sort(key=lambda item: (-item[0], item[1]))
+    for count, index, (state_from, state_to, event, buckets) in fired:
+        if count == 0:
+            latency = "never taken"
+        else:
+            worst = max(i for i, n in enumerate(buckets) if n)
+            latency = "median %s  p90 %s  max %s" % (
+                bound(percentile(buckets, 0.5), len(buckets)),
+                bound(percentile(buckets, 0.9), len(buckets)),
+                bound(worst, len(buckets)))
+        out.write("%4d  %-12s -> %-12s %-10s %8d  %s\n"
+                  % (index, state_name(state_from), state_name(state_to),
+                     event_name(event), count, latency))
+
+    out.write("\nUnmatched events:\n\n")
+    unmatched = []
+    for state, row in enumerate(profile.cells):
+        for event, (arrivals, misses) in enumerate(row):
+            if misses:
+                unmatched.append((misses, arrivals, state, event))
+    unmatched.sort(key=lambda item: (-item[0], item[2], item[3]))
+    for misses, arrivals, state, event in unmatched:
+        out.write("  %-12s %-10s %8d of %d\n"
+                  % (state_name(state), event_name(event), misses, arrivals))
+    if not unmatched:
+        out.write("  none\n")
+    if profile.other_events:
+        out.write("  %d event(s) outside the profiled states and events\n"
+                  % profile.other_events)
+
+    # Transitions for the same state and event are tried in the order they
+    # were added; a hot one behind a cold one pays for the other's guard.
+    advice = []
+    groups = {}
+    for index, (state_from, _, event, buckets) in \
+            enumerate(profile.transitions):
+        groups.setdefault((state_from, event), []).append(
+            (index, sum(buckets)))
+    for (state_from, event), group in sorted(groups.items()):
+        for position in range(1, len(group)):
+            index, count = group[position]
+            earlier = group[position - 1]
+            if count > earlier[1]:
+                advice.append("  add transition %d before %d (%s, %s): "
+                              "taken %d times against %d, if their guards "
+                              "exclude each other\n"
+                              % (index, earlier[0], state_name(state_from),
+                                 event_name(event), count, earlier[1]))
+    out.write("\nOrder:\n\n")
+    out.writelines(advice or ["  no hot transition behind a colder one\n"])
+
+    out.write("\nDispatch:\n\n")
+    dispatch(profile, state_name, out)
+
+
+def dispatch(profile, state_name, out):
+    """Say whether the dense table is used and whether it should be."""
+    if not profile.transitions:
+        out.write("  no transitions\n")
+        return
+
+    event_values = [t[2] for t in profile.transitions]
+    span = max(event_values) - min(event_values) + 1
+    needed = span * profile.num_states
+    arrivals = sum(cell[0] for row in profile.cells for cell in row)
+    per_state = {}
+    for state_from, _, _, _ in profile.transitions:
+        per_state[state_from] = per_state.get(state_from, 0) + 1
+
+    # Without the dense table every arrival costs a binary search over its
+    # state's transitions.
+    for state, row in enumerate(profile.cells):
+        count = per_state.get(state, 0)
+        received = sum(cell[0] for cell in row)
+        if received:
+            out.write("  %-12s %8d events, %3d transitions"
+                      % (state_name(state), received, count))
+            if not profile.dense:
+                out.write(", %d probes per search" % count.bit_length())
+            out.write("\n")
+
+    mode = "dense" if profile.dense else "binary search"
+    out.write("\n  the machine uses %s dispatch\n"
+              "  the dense table needs %d bytes (%d states x %d events)\n"
+              % (mode, needed, profile.num_states, span))
+    if profile.dense:
+        if arrivals == 0:
+            out.write("  no events arrived: -DFSM_DENSE_TABLE_SIZE=0 saves "
+                      "the table\n")
+    elif needed <= profile.dense_table_size:
+        out.write("  the table fits FSM_DENSE_TABLE_SIZE=%d but was not "
+                  "built:\n  compile() was not called or the machine uses "
+                  "caller provided storage\n"
+                  % profile.dense_table_size)
+    elif arrivals:
+        out.write("  build with -DFSM_DENSE_TABLE_SIZE=%d to use the dense "
+                  "table\n" % needed)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="binary capture, - for stdin")
+    parser.add_argument("--states", default="",
+                        help="comma separated state names by id")
+    parser.add_argument("--events", default="",
+                        help="comma separated event names by value")
+    args = parser.parse_args()
+
+    if args.capture == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.capture, "rb") as f:
+            data = f.read()
+
+    try:
+        profile = decode(data)
+    except (ValueError, struct.error) as e:
+        sys.stderr.write("fsm_profile: %s\n" % e)
+        return 1
+
+    states = [s for s in args.states.split(",") if s]
+    events = [e for e in args.events.split(",") if e]
+    report(profile, states, events, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
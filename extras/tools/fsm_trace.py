@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+# This file is part of arduino-fsm.
+#
+# arduino-fsm is free software: you can redistribute it and/or modify it under
+# the terms of the GNU Lesser General Public License as published by the Free
+# Software Foundation, either version 3 of the License, or (at your option)
+# any later version.
+#
+# arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+# for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Decode and replay a transition trace written by FsmTrace::dump().
+
+The input is a raw capture of the bytes the sketch wrote, e.g. saved from
+the serial port. Anything before the "FSMT" header is skipped, so the dump
+may follow other output.
+
+    fsm_trace.py capture.bin --states off,on
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"FSMT"
+VERSION = 1
+HEADER = struct.Struct("<4sBBH")
+RECORD = struct.Struct("<HBBBBh")
+
+KIND_EVENT = 0
+KIND_TIMEOUT = 1
+
+
+def decode(data):
+    """Return the list of (delta, machine, from, to, kind, event) records."""
+    start = data.find(MAGIC)
+    if start < 0:
+        raise ValueError("no FSMT header found")
+
+    magic, version, record_size, count = HEADER.unpack_from(data, start)
+    if version != VERSION:
+        raise ValueError("unsupported trace version %d" % version)
+    if record_size != RECORD.size:
+        raise ValueError("unexpected record size %d" % record_size)
+
+    offset = start + HEADER.size
+    if len(data) < offset + count * record_size:
+        raise ValueError("trace truncated: expected %d records" % count)
+    return [RECORD.unpack_from(data, offset + i * record_size)
+            for i in range(count)]
+
+
+def replay(records, states, out):
+    """Print the timeline and flag records that do not follow on.
+
+    A machine with orthogonal regions is in several states at once, so every
+    state a machine has left or entered is tracked: a record follows on if
+    its source is one of the current states or a state not seen before (the
+    first transition of another region).
+    """
+    def name(state):
+        if state < len(states):
+            return states[state]
+        return str(state)
+
+    time = 0
+    current = {}
+    seen = {}
+    gaps = 0
+    for delta, machine, state_from, state_to, kind, event in records:
+        time += delta
+        cause = "timeout" if kind == KIND_TIMEOUT else "event %d" % event
+        active = current.setdefault(machine, set())
+        known = seen.setdefault(machine, set())
+        note = ""
+        if state_from in known and state_from not in active:
+            note = "  (gap: %s was not active)" % name(state_from)
+            gaps += 1
+        active.discard(state_from)
+        active.add(state_to)
+        known.update((state_from, state_to))
+        out.write("%10d  m%-3d %-12s -> %-12s %s%s\n"
+                  % (time, machine, name(state_from), name(state_to), cause,
+                     note))
+    return gaps
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="binary capture, - for stdin")
+    parser.add_argument("--states", default="",
+                        help="comma separated state names by id")
+    args = parser.parse_args()
+
+    if args.capture == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.capture, "rb") as f:
+            data = f.read()
+
+    try:
+        records = decode(data)
+    except ValueError as e:
+        sys.stderr.write("fsm_trace: %s\n" % e)
+        return 1
+
+    states = [s for s in args.states.split(",") if s]
+    gaps = replay(records, states, sys.stdout)
+    if gaps:
+        sys.stderr.write("fsm_trace: %d gap(s), the oldest records were "
+                         "probably overwritten\n" % gaps)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
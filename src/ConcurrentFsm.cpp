@@ -0,0 +1,222 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "ConcurrentFsm.h"
+#include "FsmScheduler.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+
+ConcurrentFsm::ConcurrentFsm(State* initial_state, Slot* slots,
+                             unsigned int size)
+: Fsm(initial_state),
+  m_slots(slots),
+  m_mask(0),
+  m_enqueue(0),
+  m_dequeue(0),
+  m_task(NULL)
+{
+  // A queue that is not a power of two is not used.
+  if (slots == NULL || size == 0 || (size & (size - 1)) != 0)
+  {
+    m_slots = NULL;
+    return;
+  }
+
+  m_mask = size - 1;
+  for (unsigned int i = 0; i < size; ++i)
+    m_slots[i].sequence = i;
+
+  // So that the queue is also drained when the machine is run as an Fsm,
+  // e.g. by an FsmScheduler.
+  m_process_events =
+      static_cast<void (Fsm::*)()>(&ConcurrentFsm::process_events);
+}
+
+
+bool ConcurrentFsm::post(int event)
+{
+  if (m_slots == NULL)
+    return false;
+
+  unsigned int position = __atomic_load_n(&m_enqueue, __ATOMIC_RELAXED);
+  Slot* slot;
+  for (;;)
+  {
+    slot = &m_slots[position & m_mask];
+    unsigned int sequence = __atomic_load_n(&slot->sequence,
+                                            __ATOMIC_ACQUIRE);
+    int difference = (int) (sequence - position);
+    if (difference == 0)
+    {
+      if (__atomic_compare_exchange_n(&m_enqueue, &position, position + 1,
+                                      true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED))
+        break;
+    }
+    else if (difference < 0)
+    {
+#if FSM_INSTRUMENTATION
+      __atomic_fetch_add(&m_metrics.dropped_events, 1, __ATOMIC_RELAXED);
+#endif
+      return false;
+    }
+    else
+    {
+      position = __atomic_load_n(&m_enqueue, __ATOMIC_RELAXED);
+    }
+  }
+
+  // Publish the event before handing the slot to the consumer.
+  slot->event = event;
+  __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+
+  ConcurrentFsm::notify();
+  if (m_scheduler != NULL)
+    m_scheduler->mark_ready(this);
+  return true;
+}
+
+
+void ConcurrentFsm::notify()
+{
+  TaskHandle_t task = __atomic_load_n(&m_task, __ATOMIC_ACQUIRE);
+  if (task == NULL)
+    return;
+
+  if (xPortInIsrContext())
+  {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(task, &woken);
+    if (woken == pdTRUE)
+      portYIELD_FROM_ISR();
+  }
+  else
+  {
+    xTaskNotifyGive(task);
+  }
+}
+
+
+bool ConcurrentFsm::has_events() const
+{
+  if (m_slots == NULL)
+    return false;
+
+  const Slot* slot = &m_slots[m_dequeue & m_mask];
+  unsigned int sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+  return sequence == m_dequeue + 1;
+}
+
+
+void ConcurrentFsm::process_events()
+{
+  // Called from run_machine(), the events are delivered within its step
+  // like those of Fsm::process_events().
+  bool step = Fsm::begin_machine_step();
+
+  // Fsm's own queue and hardware timer, if the machine has them.
+  Fsm::process_events();
+
+  if (m_slots != NULL)
+  {
+    // Events posted while this runs are left for the next call.
+    unsigned int end = __atomic_load_n(&m_enqueue, __ATOMIC_ACQUIRE);
+    while (m_dequeue != end && ConcurrentFsm::has_events())
+    {
+      Slot* slot = &m_slots[m_dequeue & m_mask];
+      int event = slot->event;
+      __atomic_store_n(&slot->sequence, m_dequeue + m_mask + 1,
+                       __ATOMIC_RELEASE);
+      m_dequeue++;
+      Fsm::deliver(event);
+      Fsm::deliver_pending();
+    }
+  }
+
+  if (step)
+    Fsm::end_machine_step();
+}
+
+
+void ConcurrentFsm::wake()
+{
+  Fsm::wake();
+  ConcurrentFsm::notify();
+}
+
+
+void ConcurrentFsm::run_machine()
+{
+  ConcurrentFsm::run_machine(FSM_CLOCK());
+}
+
+
+void ConcurrentFsm::run_machine(unsigned long now)
+{
+  // The first call makes the calling task the owner that posts wake up.
+  if (m_task == NULL)
+    __atomic_store_n(&m_task, xTaskGetCurrentTaskHandle(), __ATOMIC_RELEASE);
+
+  // Fsm::run_machine() dispatches the queued events through
+  // m_process_events.
+  Fsm::run_machine(now);
+}
+
+
+void ConcurrentFsm::run_until_idle(unsigned long timeout_ms)
+{
+  TickType_t start = xTaskGetTickCount();
+  TickType_t limit = timeout_ms == portMAX_DELAY ? portMAX_DELAY
+                                                 : pdMS_TO_TICKS(timeout_ms);
+  for (;;)
+  {
+    ConcurrentFsm::run_machine();
+
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    if (limit != portMAX_DELAY && elapsed >= limit)
+      return;
+    if (ConcurrentFsm::has_events())
+      continue;
+
+    TickType_t wait = limit == portMAX_DELAY ? portMAX_DELAY
+                                             : limit - elapsed;
+    if (Fsm::has_on_state())
+    {
+      wait = 1;
+    }
+    else
+    {
+      unsigned long timeout = Fsm::ms_until_next_timeout();
+      if (timeout == 0)
+        continue;
+      if (timeout != FSM_NO_TIMEOUT)
+      {
+        // Round up so the deadline has passed when the task wakes.
+        unsigned long long ticks =
+            ((unsigned long long) timeout * configTICK_RATE_HZ
+             + FSM_CLOCK_HZ - 1) / FSM_CLOCK_HZ;
+        if (ticks < wait)
+          wait = ticks;
+      }
+    }
+
+    ulTaskNotifyTake(pdTRUE, wait);
+  }
+}
+
+
+#endif
@@ -0,0 +1,96 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef CONCURRENT_FSM_H
+#define CONCURRENT_FSM_H
+
+
+#include "Fsm.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+
+// A machine for FreeRTOS targets with several cores. Events may be posted
+// from any task on any core, or from interrupt handlers, into a lock-free
+// queue; one task owns the machine and is the only one to dispatch them.
+// That task calls run_until_idle() (or run_machine()), and it alone
+// may call trigger(), add transitions or otherwise touch the machine.
+//
+//   ConcurrentFsm::Slot slots[16];
+//   ConcurrentFsm fsm(&state_idle, slots, 16);
+//
+//   void fsm_task(void*) { for (;;) fsm.run_until_idle(portMAX_DELAY); }
+//
+// The queue is also dispatched when the machine is run through an Fsm
+// pointer, so it can be added to an FsmScheduler; the task that calls
+// FsmScheduler::run() then owns it. post() and wake() must still be called
+// on the ConcurrentFsm, as Fsm::post() uses the set_event_queue() buffer.
+class ConcurrentFsm : public Fsm
+{
+public:
+  struct Slot
+  {
+    unsigned int sequence;
+    int event;
+  };
+
+  // The queue holds size events; size must be a power of two.
+  ConcurrentFsm(State* initial_state, Slot* slots, unsigned int size);
+
+  // Queue an event and wake the owning task. Safe from any task or
+  // interrupt handler. Returns false if the queue is full and the event was
+  // dropped.
+  bool post(int event);
+
+  // Dispatch the events posted so far, in order.
+  void process_events();
+
+  void run_machine();
+  void run_machine(unsigned long now);
+
+  // Fsm::wake() that also unblocks the owning task. Safe from any task or
+  // interrupt handler.
+  void wake();
+
+  // Run the machine on the calling task for timeout_ms milliseconds. While
+  // there is nothing to do the task blocks until an event is posted or the
+  // next timed transition is due, instead of polling. States with an
+  // on_state() handler are run once per RTOS tick.
+  void run_until_idle(unsigned long timeout_ms);
+
+private:
+  bool has_events() const;
+  void notify();
+
+private:
+  // Bounded multi-producer queue: a producer claims a position with a
+  // compare-and-swap on m_enqueue, and a slot's sequence tells whether it
+  // is free for that position or holds its event.
+  Slot* m_slots;
+  unsigned int m_mask;
+  unsigned int m_enqueue;
+  unsigned int m_dequeue;
+
+  TaskHandle_t m_task;
+};
+
+
+#endif
+
+#endif
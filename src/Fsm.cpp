@@ -0,0 +1,1382 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "Fsm.h"
+#include "FsmScheduler.h"
+#include "FsmTimer.h"
+#include "FsmTrace.h"
+#include "FsmProfile.h"
+
+
+#if FSM_INSTRUMENTATION
+  #define FSM_CALL(state, handler, worst_us) \
+    FsmInstance::measure(state, handler, &(worst_us))
+#else
+  #define FSM_CALL(state, handler, worst_us) \
+    FsmInstance::call_handler(state, handler)
+#endif
+
+State::State(void (*on_enter)(), void (*on_state)(), void (*on_exit)(),
+             State* parent)
+: on_enter(on_enter),
+#if FSM_ON_STATE
+  on_state(on_state),
+#endif
+  on_exit(on_exit),
+  parent(parent),
+#if FSM_ON_STATE
+  poll_interval(0),
+#endif
+  takes_context(false)
+{
+#if !FSM_ON_STATE
+  (void) on_state;
+#endif
+}
+
+
+State::State(FsmContextHandler on_enter, FsmContextHandler on_state,
+             FsmContextHandler on_exit, State* parent)
+: on_enter((void (*)()) on_enter.function),
+#if FSM_ON_STATE
+  on_state((void (*)()) on_state.function),
+#endif
+  on_exit((void (*)()) on_exit.function),
+  parent(parent),
+#if FSM_ON_STATE
+  poll_interval(0),
+#endif
+  takes_context(true)
+{
+#if !FSM_ON_STATE
+  (void) on_state;
+#endif
+}
+
+
+FsmDefinition::FsmDefinition(State* initial_state)
+: m_states(NULL),
+  m_num_states(0),
+  m_states_capacity(0),
+  m_transitions(NULL),
+  m_num_transitions(0),
+  m_transitions_capacity(0),
+#if FSM_TIMED_TRANSITIONS
+  m_timed_transitions(NULL),
+  m_num_timed_transitions(0),
+  m_timed_transitions_capacity(0),
+#endif
+  m_callbacks(NULL),
+  m_num_callbacks(0),
+  m_callbacks_capacity(0),
+  m_dense(NULL),
+  m_dense_event_min(0),
+  m_dense_event_span(0),
+#if FSM_INSTRUMENTATION
+  m_metrics(),
+#endif
+  m_owns_storage(true),
+  m_compiled(false)
+{
+  FsmDefinition::register_state(initial_state);
+}
+
+
+FsmDefinition::FsmDefinition(State* initial_state, StateSlot* states,
+                             int state_capacity, Transition* transitions,
+                             int capacity, TimedTransition* timed_transitions,
+                             int timed_capacity, Callback* callbacks,
+                             int callback_capacity)
+: m_states(states),
+  m_num_states(0),
+  m_states_capacity(states != NULL ? state_capacity : 0),
+  m_transitions(transitions),
+  m_num_transitions(0),
+  m_transitions_capacity(transitions != NULL ? capacity : 0),
+#if FSM_TIMED_TRANSITIONS
+  m_timed_transitions(timed_transitions),
+  m_num_timed_transitions(0),
+  m_timed_transitions_capacity(timed_transitions != NULL ? timed_capacity : 0),
+#endif
+  m_callbacks(callbacks),
+  m_num_callbacks(0),
+  m_callbacks_capacity(callbacks != NULL ? callback_capacity : 0),
+  m_dense(NULL),
+  m_dense_event_min(0),
+  m_dense_event_span(0),
+#if FSM_INSTRUMENTATION
+  m_metrics(),
+#endif
+  m_owns_storage(false),
+  m_compiled(false)
+{
+#if !FSM_TIMED_TRANSITIONS
+  (void) timed_transitions;
+  (void) timed_capacity;
+#endif
+  FsmDefinition::register_state(initial_state);
+}
+
+
+FsmDefinition::~FsmDefinition()
+{
+  if (m_owns_storage)
+  {
+    free(m_states);
+    free(m_transitions);
+#if FSM_TIMED_TRANSITIONS
+    free(m_timed_transitions);
+#endif
+    free(m_callbacks);
+    free(m_dense);
+  }
+  m_states = NULL;
+  m_transitions = NULL;
+#if FSM_TIMED_TRANSITIONS
+  m_timed_transitions = NULL;
+#endif
+  m_callbacks = NULL;
+  m_dense = NULL;
+}
+
+
+bool FsmDefinition::reserve(int num_transitions, int num_timed_transitions,
+                  int num_states, int num_callbacks)
+{
+  bool ok = FsmDefinition::reserve_transitions(num_transitions);
+#if FSM_TIMED_TRANSITIONS
+  ok = FsmDefinition::reserve_timed_transitions(num_timed_transitions) && ok;
+#else
+  ok = num_timed_transitions <= 0 && ok;
+#endif
+  ok = FsmDefinition::reserve_states(num_states) && ok;
+  return FsmDefinition::reserve_callbacks(num_callbacks) && ok;
+}
+
+
+bool FsmDefinition::reserve_states(int capacity)
+{
+  if (capacity <= m_states_capacity)
+    return true;
+  if (!m_owns_storage)
+    return false;
+
+  StateSlot* states = (StateSlot*) realloc(m_states, capacity
+                                           * sizeof(StateSlot));
+  if (states == NULL)
+    return false;
+  m_states = states;
+  m_states_capacity = capacity;
+  return true;
+}
+
+
+bool FsmDefinition::reserve_callbacks(int capacity)
+{
+  if (capacity <= m_callbacks_capacity)
+    return true;
+  if (!m_owns_storage)
+    return false;
+
+  Callback* callbacks = (Callback*) realloc(m_callbacks, capacity
+                                            * sizeof(Callback));
+  if (callbacks == NULL)
+    return false;
+  m_callbacks = callbacks;
+  m_callbacks_capacity = capacity;
+  return true;
+}
+
+
+bool FsmDefinition::reserve_transitions(int capacity)
+{
+  if (capacity <= m_transitions_capacity)
+    return true;
+  if (!m_owns_storage)
+    return false;
+
+  Transition* transitions = (Transition*) realloc(m_transitions, capacity
+                                                  * sizeof(Transition));
+  if (transitions == NULL)
+    return false;
+  m_transitions = transitions;
+  m_transitions_capacity = capacity;
+  return true;
+}
+
+
+fsm_state_t FsmDefinition::register_state(State* state)
+{
+  if (state == NULL)
+    return FSM_NO_STATE;
+
+  for (int i = 0; i < m_num_states; ++i)
+  {
+    if (m_states[i].state == state)
+      return i;
+  }
+
+  if (m_num_states == FSM_NO_STATE)
+    return FSM_NO_STATE;
+  if (m_num_states == m_states_capacity &&
+      !FsmDefinition::reserve_states(m_num_states + m_num_states / 2 + 1))
+    return FSM_NO_STATE;
+
+  fsm_state_t id = m_num_states;
+  StateSlot* slot = &m_states[id];
+  slot->state = state;
+  slot->parent = FSM_NO_STATE;
+  slot->first_transition = 0;
+#if FSM_TIMED_TRANSITIONS
+  slot->first_timed_transition = 0;
+#endif
+#if FSM_INSTRUMENTATION
+  memset(&slot->metrics, 0, sizeof(slot->metrics));
+#endif
+  m_num_states++;
+  m_compiled = false;
+
+  // Parents are registered after their children, so look the slot up again.
+  if (state->parent != NULL)
+  {
+    fsm_state_t parent = FsmDefinition::register_state(state->parent);
+    m_states[id].parent = parent;
+  }
+  return id;
+}
+
+
+bool FsmDefinition::register_callback(void (*function)(),
+                                      bool takes_context,
+                                      fsm_callback_t* callback)
+{
+  *callback = FSM_NO_CALLBACK;
+  if (function == NULL)
+    return true;
+
+  for (int i = 0; i < m_num_callbacks; ++i)
+  {
+    if (m_callbacks[i].function == function &&
+        m_callbacks[i].takes_context == takes_context)
+    {
+      *callback = i;
+      return true;
+    }
+  }
+
+  if (m_num_callbacks == FSM_NO_CALLBACK)
+    return false;
+  if (m_num_callbacks == m_callbacks_capacity &&
+      !FsmDefinition::reserve_callbacks(m_num_callbacks
+                                        + m_num_callbacks / 2 + 1))
+    return false;
+
+  m_callbacks[m_num_callbacks].function = function;
+  m_callbacks[m_num_callbacks].takes_context = takes_context;
+  *callback = m_num_callbacks++;
+  return true;
+}
+
+
+bool FsmDefinition::add_transition(State* state_from, State* state_to,
+                                   int event, void (*on_transition)())
+{
+  return FsmDefinition::add_transition(state_from, state_to, event, NULL,
+                                       on_transition, false);
+}
+
+
+bool FsmDefinition::add_transition(State* state_from, State* state_to,
+                                   int event, bool (*guard)(),
+                                   void (*on_transition)())
+{
+  return FsmDefinition::add_transition(state_from, state_to, event,
+                                       (void (*)()) guard, on_transition,
+                                       false);
+}
+
+
+bool FsmDefinition::add_transition(State* state_from, State* state_to,
+                                   int event,
+                                   FsmContextHandler on_transition)
+{
+  return FsmDefinition::add_transition(state_from, state_to, event, NULL,
+                                       (void (*)()) on_transition.function,
+                                       true);
+}
+
+
+bool FsmDefinition::add_transition(State* state_from, State* state_to,
+                                   int event, FsmContextGuard guard,
+                                   FsmContextHandler on_transition)
+{
+  return FsmDefinition::add_transition(state_from, state_to, event,
+                                       (void (*)()) guard.function,
+                                       (void (*)()) on_transition.function,
+                                       true);
+}
+
+
+bool FsmDefinition::add_transition(State* state_from, State* state_to,
+                                   int event, void (*guard)(),
+                                   void (*on_transition)(),
+                                   bool takes_context)
+{
+  fsm_state_t from = FsmDefinition::register_state(state_from);
+  fsm_state_t to = FsmDefinition::register_state(state_to);
+  fsm_callback_t callback;
+  fsm_callback_t guard_callback;
+  if (from == FSM_NO_STATE || to == FSM_NO_STATE ||
+      !FsmDefinition::register_callback(on_transition, takes_context,
+                                        &callback) ||
+      !FsmDefinition::register_callback(guard, takes_context,
+                                        &guard_callback))
+    return false;
+
+  // Grow by half again when full, so setup does not copy the table on
+  // every call.
+  if (m_num_transitions == m_transitions_capacity &&
+      !FsmDefinition::reserve_transitions(m_num_transitions
+                                          + m_num_transitions / 2 + 1))
+    return false;
+
+  Transition transition = FsmDefinition::create_transition(from, to, event,
+                                                           callback);
+  transition.guard = guard_callback;
+  m_transitions[m_num_transitions] = transition;
+  m_num_transitions++;
+  m_compiled = false;
+  return true;
+}
+
+
+FsmDefinition::Transition FsmDefinition::create_transition(
+    fsm_state_t state_from, fsm_state_t state_to, int event,
+    fsm_callback_t on_transition)
+{
+  Transition t;
+  t.state_from = state_from;
+  t.state_to = state_to;
+  t.event = event;
+  t.on_transition = on_transition;
+  t.guard = FSM_NO_CALLBACK;
+#if FSM_INSTRUMENTATION
+  t.fired = 0;
+#endif
+
+  return t;
+}
+
+bool FsmDefinition::transition_less(const Transition& a, const Transition& b)
+{
+  if (a.state_from != b.state_from)
+    return a.state_from < b.state_from;
+  return a.event < b.event;
+}
+
+void FsmDefinition::compile()
+{
+  // Insertion sort is stable, so transitions sharing a state and event keep
+  // the order they were added in and the first match stays the same.
+  for (int i = 1; i < m_num_transitions; ++i)
+  {
+    Transition transition = m_transitions[i];
+    int j = i;
+    while (j > 0 && transition_less(transition, m_transitions[j - 1]))
+    {
+      m_transitions[j] = m_transitions[j - 1];
+      --j;
+    }
+    m_transitions[j] = transition;
+  }
+
+#if FSM_TIMED_TRANSITIONS
+  for (int i = 1; i < m_num_timed_transitions; ++i)
+  {
+    TimedTransition transition = m_timed_transitions[i];
+    int j = i;
+    while (j > 0 && transition.transition.state_from <
+                    m_timed_transitions[j - 1].transition.state_from)
+    {
+      m_timed_transitions[j] = m_timed_transitions[j - 1];
+      --j;
+    }
+    m_timed_transitions[j] = transition;
+  }
+#endif
+
+  // Record where each state's group starts.
+  int t = 0;
+#if FSM_TIMED_TRANSITIONS
+  int tt = 0;
+#endif
+  for (int i = 0; i < m_num_states; ++i)
+  {
+    while (t < m_num_transitions && m_transitions[t].state_from < i)
+      ++t;
+    m_states[i].first_transition = t;
+#if FSM_TIMED_TRANSITIONS
+    while (tt < m_num_timed_transitions &&
+           m_timed_transitions[tt].transition.state_from < i)
+      ++tt;
+    m_states[i].first_timed_transition = tt;
+#endif
+  }
+
+  m_compiled = true;
+  FsmDefinition::compile_dense_table();
+}
+
+void FsmDefinition::compile_dense_table()
+{
+  if (m_owns_storage)
+    free(m_dense);
+  m_dense = NULL;
+
+  if (!m_owns_storage || m_num_transitions == 0)
+    return;
+
+  int event_min = m_transitions[0].event;
+  int event_max = m_transitions[0].event;
+  for (int i = 1; i < m_num_transitions; ++i)
+  {
+    if (m_transitions[i].event < event_min)
+      event_min = m_transitions[i].event;
+    if (m_transitions[i].event > event_max)
+      event_max = m_transitions[i].event;
+  }
+
+  long span = (long) event_max - event_min + 1;
+  if (span > FSM_DENSE_TABLE_SIZE / m_num_states)
+    return;
+  for (int i = 0; i < m_num_states; ++i)
+  {
+    if (FsmDefinition::transitions_end(i) - m_states[i].first_transition
+        > 0xFF)
+      return;
+  }
+
+  m_dense = (uint8_t*) calloc(m_num_states * span, 1);
+  if (m_dense == NULL)
+    return;
+  m_dense_event_min = event_min;
+  m_dense_event_span = span;
+
+  for (int i = 0; i < m_num_states; ++i)
+  {
+    int begin = m_states[i].first_transition;
+    int end = FsmDefinition::transitions_end(i);
+    uint8_t* row = &m_dense[i * span];
+    for (int j = begin; j < end; ++j)
+    {
+      uint8_t* entry = &row[m_transitions[j].event - event_min];
+      if (*entry == 0)
+        *entry = j - begin + 1;
+    }
+  }
+}
+
+int FsmDefinition::transitions_end(fsm_state_t state) const
+{
+  if (state + 1 < m_num_states)
+    return m_states[state + 1].first_transition;
+  return m_num_transitions;
+}
+
+bool FsmDefinition::is_timed(const Transition* transition) const
+{
+#if FSM_TIMED_TRANSITIONS
+  // Timed transitions live inside the timed table's entries.
+  uintptr_t address = (uintptr_t) transition;
+  return address >= (uintptr_t) m_timed_transitions &&
+         address < (uintptr_t) (m_timed_transitions
+                                + m_num_timed_transitions);
+#else
+  (void) transition;
+  return false;
+#endif
+}
+
+bool FsmDefinition::is_ancestor(fsm_state_t ancestor,
+                                fsm_state_t state) const
+{
+  for (state = m_states[state].parent; state != FSM_NO_STATE;
+       state = m_states[state].parent)
+  {
+    if (state == ancestor)
+      return true;
+  }
+  return false;
+}
+
+fsm_state_t FsmDefinition::common_ancestor(fsm_state_t state_from,
+                                           fsm_state_t state_to) const
+{
+  // The innermost state that strictly contains both ends, so a transition
+  // to self or to an enclosing state exits and re-enters that state.
+  fsm_state_t ancestor = m_states[state_from].parent;
+  while (ancestor != FSM_NO_STATE &&
+         !FsmDefinition::is_ancestor(ancestor, state_to))
+    ancestor = m_states[ancestor].parent;
+  return ancestor;
+}
+
+
+FsmInstance::FsmInstance(const FsmDefinition* definition)
+: m_definition(definition),
+  m_context(NULL),
+#if FSM_TIMED_TRANSITIONS
+  m_timer(-1),
+  m_timer_start(0),
+  m_timer_armed(false),
+#endif
+#if FSM_FINE_TIMERS
+  m_fine_timer(-1),
+  m_fine_timer_start(0),
+#endif
+#if FSM_ON_STATE
+  m_last_poll(0),
+  m_woken(false),
+#endif
+#if FSM_INSTRUMENTATION
+  m_entered(0),
+#endif
+#if FSM_DEFERRED_EVENTS > 0
+  m_deferred_head(0),
+  m_num_deferred(0),
+  m_busy(false),
+#endif
+  m_current_state(0),
+  m_initialized(false),
+  m_owner(NULL)
+{
+}
+
+void FsmInstance::set_definition(const FsmDefinition* definition)
+{
+  m_definition = definition;
+#if FSM_TIMED_TRANSITIONS
+  m_timer = -1;
+  m_timer_start = 0;
+  m_timer_armed = false;
+#endif
+#if FSM_FINE_TIMERS
+  m_fine_timer = -1;
+  m_fine_timer_start = 0;
+#endif
+#if FSM_ON_STATE
+  m_woken = false;
+#endif
+#if FSM_DEFERRED_EVENTS > 0
+  m_num_deferred = 0;
+  m_busy = false;
+#endif
+  m_current_state = 0;
+  m_initialized = false;
+}
+
+void FsmInstance::set_context(void* context)
+{
+  m_context = context;
+}
+
+void* FsmInstance::get_context() const
+{
+  return m_context;
+}
+
+void FsmInstance::call_handler(const State* state, void (*handler)())
+{
+  if (state->takes_context)
+    ((void (*)(void*)) handler)(m_context);
+  else
+    handler();
+}
+
+bool FsmInstance::guard_passes(const Transition* transition)
+{
+  if (transition->guard == FSM_NO_CALLBACK)
+    return true;
+
+  const Callback* guard = &m_definition->m_callbacks[transition->guard];
+  if (guard->takes_context)
+    return ((bool (*)(void*)) guard->function)(m_context);
+  return ((bool (*)()) guard->function)();
+}
+
+const FsmInstance::Transition* FsmInstance::find_transition(
+    fsm_state_t state, int event)
+{
+  const FsmDefinition* definition = m_definition;
+  const Transition* transitions = definition->m_transitions;
+  if (!definition->m_compiled)
+  {
+    int count = definition->m_num_transitions;
+    for (int i = 0; i < count; ++i)
+    {
+      const Transition* transition = &transitions[i];
+      if (transition->state_from == state && transition->event == event &&
+          FsmInstance::guard_passes(transition))
+        return transition;
+    }
+    return NULL;
+  }
+
+  int lo = definition->m_states[state].first_transition;
+  int end = definition->transitions_end(state);
+  if (definition->m_dense != NULL)
+  {
+    unsigned int offset = (unsigned int) event
+                          - (unsigned int) definition->m_dense_event_min;
+    if (offset >= (unsigned int) definition->m_dense_event_span)
+      return NULL;
+    uint8_t index = definition->m_dense[state * definition->m_dense_event_span
+                                        + offset];
+    if (index == 0)
+      return NULL;
+    lo += index - 1;
+  }
+  else
+  {
+    // Lower bound on event within the current state's group.
+    int hi = end;
+    while (lo < hi)
+    {
+      int mid = lo + (hi - lo) / 2;
+      if (transitions[mid].event < event)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  }
+
+  // Transitions for the same event follow each other in the order they
+  // were added; take the first whose guard passes.
+  for (; lo < end && transitions[lo].event == event; ++lo)
+  {
+    if (transitions[lo].guard == FSM_NO_CALLBACK ||
+        FsmInstance::guard_passes(&transitions[lo]))
+      return &transitions[lo];
+  }
+  return NULL;
+}
+
+const FsmInstance::Transition* FsmInstance::lookup_transition(
+    fsm_state_t state, int event)
+{
+  // Events the state does not handle bubble up to its parents.
+  while (state != FSM_NO_STATE)
+  {
+    const Transition* transition = FsmInstance::find_transition(state, event);
+    if (transition != NULL)
+      return transition;
+    state = m_definition->m_states[state].parent;
+  }
+  return NULL;
+}
+
+bool FsmInstance::begin_step()
+{
+#if FSM_DEFERRED_EVENTS > 0
+  if (m_busy)
+    return false;
+  m_busy = true;
+#endif
+  return true;
+}
+
+void FsmInstance::end_step()
+{
+#if FSM_DEFERRED_EVENTS > 0
+  // Handle the deferred events in order, including any their handlers
+  // defer in turn, without growing the stack.
+  while (m_num_deferred > 0)
+  {
+    int event = m_deferred[m_deferred_head];
+    if (++m_deferred_head == FSM_DEFERRED_EVENTS)
+      m_deferred_head = 0;
+    m_num_deferred--;
+    FsmInstance::dispatch(event);
+  }
+  m_busy = false;
+#endif
+}
+
+void FsmInstance::defer(int event)
+{
+#if FSM_DEFERRED_EVENTS > 0
+  if (m_num_deferred == FSM_DEFERRED_EVENTS)
+  {
+#if FSM_INSTRUMENTATION
+    m_definition->m_metrics.dropped_events++;
+#endif
+    return;
+  }
+
+  uint8_t tail = m_deferred_head + m_num_deferred;
+  if (tail >= FSM_DEFERRED_EVENTS)
+    tail -= FSM_DEFERRED_EVENTS;
+  m_deferred[tail] = event;
+  m_num_deferred++;
+#else
+  (void) event;
+#endif
+}
+
+void FsmInstance::dispatch(int event)
+{
+#if FSM_PROFILING
+  unsigned long start = micros();
+  fsm_state_t state = m_current_state;
+#endif
+  // Find the transition with the current state and given event.
+  const Transition* transition =
+      FsmInstance::lookup_transition(m_current_state, event);
+  if (transition != NULL)
+    FsmInstance::make_transition(transition);
+#if FSM_INSTRUMENTATION
+  else
+    m_definition->m_metrics.unmatched_events++;
+#endif
+#if FSM_PROFILING
+  FsmProfile* profile = m_owner != NULL ? m_owner->m_profile : NULL;
+  if (profile != NULL)
+  {
+    profile->record_event(state, event, transition != NULL);
+    if (transition != NULL)
+      profile->record_latency(transition - m_definition->m_transitions,
+                              micros() - start);
+  }
+#endif
+}
+
+void FsmInstance::trigger(int event)
+{
+  if (!m_initialized)
+    return;
+
+  if (!FsmInstance::begin_step())
+  {
+    FsmInstance::defer(event);
+    return;
+  }
+  FsmInstance::dispatch(event);
+  FsmInstance::end_step();
+}
+
+void FsmInstance::trigger_many(const int* events, size_t count)
+{
+  if (!m_initialized)
+    return;
+
+  if (!FsmInstance::begin_step())
+  {
+    for (size_t i = 0; i < count; ++i)
+      FsmInstance::defer(events[i]);
+    return;
+  }
+
+  while (count > 0)
+  {
+    size_t burst = count < FSM_BURST_SIZE ? count : FSM_BURST_SIZE;
+    FsmInstance::run_burst(events, burst);
+    events += burst;
+    count -= burst;
+  }
+  FsmInstance::end_step();
+}
+
+void FsmInstance::run_burst(const int* events, size_t count)
+{
+  // Pick every transition before running any handler, so the handlers run
+  // and the state entered follow the same path.
+  const Transition* taken[FSM_BURST_SIZE];
+  fsm_state_t state_to = m_current_state;
+  const Transition* last = NULL;
+  for (size_t i = 0; i < count; ++i)
+  {
+    const Transition* transition =
+        FsmInstance::lookup_transition(state_to, events[i]);
+#if FSM_PROFILING
+    if (m_owner != NULL && m_owner->m_profile != NULL)
+      m_owner->m_profile->record_event(state_to, events[i],
+                                       transition != NULL);
+#endif
+    taken[i] = transition;
+    if (transition != NULL)
+    {
+      last = transition;
+      state_to = transition->state_to;
+    }
+#if FSM_INSTRUMENTATION
+    else
+      m_definition->m_metrics.unmatched_events++;
+#endif
+  }
+  if (last == NULL)
+    return;
+
+  fsm_state_t ancestor = m_definition->common_ancestor(m_current_state,
+                                                       state_to);
+  FsmInstance::exit_states(ancestor);
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (taken[i] != NULL)
+      FsmInstance::run_transition_handler(taken[i]);
+  }
+  FsmInstance::enter_states(ancestor, state_to);
+  FsmInstance::finish_transition(last);
+}
+
+void FsmInstance::wake()
+{
+#if FSM_ON_STATE
+  m_woken = true;
+#endif
+}
+
+#if FSM_ON_STATE
+bool FsmInstance::poll_due(const State* state, unsigned long now)
+{
+  unsigned long interval = state->poll_interval;
+  if (interval != 0 && !m_woken &&
+      (interval == FSM_POLL_ON_WAKE || now - m_last_poll < interval))
+    return false;
+
+  // Clear the flag before the handler runs, so a wake() from an interrupt
+  // meanwhile is not lost.
+  m_woken = false;
+  m_last_poll = now;
+  return true;
+}
+#endif
+
+bool FsmInstance::start(unsigned long now)
+{
+  if (m_definition == NULL || m_definition->m_num_states == 0)
+    return false;
+
+  // first run must exec first state "on_enter"
+  if (!m_initialized)
+  {
+    m_initialized = true;
+#if !FSM_TIMED_TRANSITIONS && !FSM_ON_STATE
+    (void) now;
+#endif
+#if FSM_TIMED_TRANSITIONS
+    m_timer_start = now;
+    m_timer_armed = true;
+#endif
+#if FSM_FINE_TIMERS
+    m_fine_timer_start = FSM_FINE_CLOCK();
+#endif
+#if FSM_ON_STATE
+    m_last_poll = now;
+    m_woken = true;
+#endif
+    FsmInstance::select_timer();
+#if FSM_INSTRUMENTATION
+    m_entered = millis();
+#endif
+    // Enter the initial state's parents first, as a transition would.
+    if (FsmInstance::begin_step())
+    {
+      FsmInstance::enter_states(FSM_NO_STATE, m_current_state);
+      FsmInstance::end_step();
+    }
+
+    if (m_owner != NULL)
+      m_owner->region_started();
+  }
+  return true;
+}
+
+void FsmInstance::run_machine()
+{
+  FsmInstance::run_machine(FSM_CLOCK());
+}
+
+void FsmInstance::run_machine(unsigned long now)
+{
+  if (FsmInstance::start(now))
+    FsmInstance::run_state(now);
+}
+
+void FsmInstance::run_state(unsigned long now, bool check_timers)
+{
+#if FSM_ON_STATE
+  const StateSlot* state = &m_definition->m_states[m_current_state];
+
+  if (state->state->on_state != NULL &&
+      FsmInstance::poll_due(state->state, now) && FsmInstance::begin_step())
+  {
+    FSM_CALL(state->state, state->state->on_state,
+             state->metrics.max_on_state_us);
+    FsmInstance::end_step();
+  }
+#endif
+    
+  if (check_timers)
+    FsmInstance::check_timed_transitions(now);
+}
+
+bool FsmInstance::has_on_state() const
+{
+#if FSM_ON_STATE
+  if (!m_initialized)
+    return true;
+  const State* state = m_definition->m_states[m_current_state].state;
+  return state->on_state != NULL && state->poll_interval == 0;
+#else
+  // Still true before the first run, so the initial state gets entered.
+  return !m_initialized;
+#endif
+}
+
+void FsmInstance::enter_states(fsm_state_t ancestor, fsm_state_t state)
+{
+  if (state == ancestor)
+    return;
+
+  // Outermost first.
+  FsmInstance::enter_states(ancestor, m_definition->m_states[state].parent);
+  const StateSlot* entered = &m_definition->m_states[state];
+  if (entered->state->on_enter != NULL)
+    FSM_CALL(entered->state, entered->state->on_enter,
+             entered->metrics.max_on_enter_us);
+}
+
+void FsmInstance::exit_states(fsm_state_t ancestor)
+{
+  const StateSlot* states = m_definition->m_states;
+#if FSM_INSTRUMENTATION
+  unsigned long now = millis();
+  states[m_current_state].metrics.dwell_ms += now - m_entered;
+  m_entered = now;
+#endif
+
+  // Innermost first.
+  for (fsm_state_t state = m_current_state; state != ancestor;
+       state = states[state].parent)
+  {
+    const StateSlot* exited = &states[state];
+    if (exited->state->on_exit != NULL)
+      FSM_CALL(exited->state, exited->state->on_exit,
+               exited->metrics.max_on_exit_us);
+  }
+}
+
+void FsmInstance::run_transition_handler(const Transition* transition)
+{
+  if (transition->on_transition != FSM_NO_CALLBACK)
+  {
+    const Callback* callback =
+        &m_definition->m_callbacks[transition->on_transition];
+    if (callback->takes_context)
+      ((void (*)(void*)) callback->function)(m_context);
+    else
+      callback->function();
+  }
+#if FSM_INSTRUMENTATION
+  transition->fired++;
+#endif
+}
+
+void FsmInstance::finish_transition(const Transition* transition)
+{
+  fsm_state_t state_from = m_current_state;
+  m_current_state = transition->state_to;
+
+  //Initialice all timed transitions from m_current_state
+#if FSM_TIMED_TRANSITIONS || FSM_ON_STATE
+  unsigned long now = FSM_CLOCK();
+#endif
+#if FSM_TIMED_TRANSITIONS
+  m_timer_start = now;
+  m_timer_armed = true;
+#endif
+#if FSM_FINE_TIMERS
+  m_fine_timer_start = FSM_FINE_CLOCK();
+#endif
+#if FSM_ON_STATE
+  m_last_poll = now;
+  m_woken = true;
+#endif
+  FsmInstance::select_timer();
+
+  if (m_owner != NULL)
+    m_owner->transition_taken(state_from, transition);
+}
+
+void FsmInstance::make_transition(const Transition* transition)
+{
+  fsm_state_t ancestor = m_definition->common_ancestor(transition->state_from,
+                                                       transition->state_to);
+
+  // Execute the handlers in the correct order: exit from the current state
+  // outwards, then enter inwards to the target.
+  FsmInstance::exit_states(ancestor);
+  FsmInstance::run_transition_handler(transition);
+  FsmInstance::enter_states(ancestor, transition->state_to);
+  FsmInstance::finish_transition(transition);
+}
+
+
+Fsm::Fsm(State* initial_state)
+: FsmDefinition(initial_state),
+  FsmInstance(this),
+  m_queue(NULL),
+  m_queue_size(0),
+  m_queue_head(0),
+  m_queue_tail(0),
+  m_scheduler(NULL),
+  m_next_ready(NULL),
+  m_ready(false),
+  m_stale(false),
+  m_next_stale(NULL),
+  m_slot(0),
+  m_deadline(0),
+  m_trace(NULL),
+  m_trace_machine(0),
+#if FSM_DEFERRED_EVENTS > 0
+  m_pending_head(0),
+  m_num_pending(0),
+  m_stepping(false),
+#endif
+  m_process_events(NULL),
+  m_hardware_timer(NULL),
+  m_timeout_due(false),
+  m_regions(NULL),
+  m_num_regions(0),
+  m_regions_capacity(0)
+#if FSM_INSTRUMENTATION
+  , m_metrics_hook(NULL)
+#endif
+#if FSM_PROFILING
+  , m_profile(NULL)
+#endif
+{
+  m_owner = this;
+}
+
+
+Fsm::Fsm(State* initial_state, StateSlot* states, int state_capacity,
+         Transition* transitions, int capacity,
+         TimedTransition* timed_transitions, int timed_capacity,
+         Callback* callbacks, int callback_capacity)
+: FsmDefinition(initial_state, states, state_capacity, transitions, capacity,
+                timed_transitions, timed_capacity, callbacks,
+                callback_capacity),
+  FsmInstance(this),
+  m_queue(NULL),
+  m_queue_size(0),
+  m_queue_head(0),
+  m_queue_tail(0),
+  m_scheduler(NULL),
+  m_next_ready(NULL),
+  m_ready(false),
+  m_stale(false),
+  m_next_stale(NULL),
+  m_slot(0),
+  m_deadline(0),
+  m_trace(NULL),
+  m_trace_machine(0),
+#if FSM_DEFERRED_EVENTS > 0
+  m_pending_head(0),
+  m_num_pending(0),
+  m_stepping(false),
+#endif
+  m_process_events(NULL),
+  m_hardware_timer(NULL),
+  m_timeout_due(false),
+  m_regions(NULL),
+  m_num_regions(0),
+  m_regions_capacity(0)
+#if FSM_INSTRUMENTATION
+  , m_metrics_hook(NULL)
+#endif
+#if FSM_PROFILING
+  , m_profile(NULL)
+#endif
+{
+  m_owner = this;
+}
+
+
+Fsm::~Fsm()
+{
+  if (m_hardware_timer != NULL)
+    m_hardware_timer->end();
+  free(m_regions);
+  m_regions = NULL;
+}
+
+
+bool Fsm::add_region(State* initial_state)
+{
+  if (!FsmDefinition::m_owns_storage)
+    return false;
+
+  fsm_state_t state = FsmDefinition::register_state(initial_state);
+  if (state == FSM_NO_STATE || m_num_regions == 0xFF)
+    return false;
+
+  if (m_num_regions == m_regions_capacity)
+  {
+    int capacity = m_regions_capacity + m_regions_capacity / 2 + 1;
+    if (capacity > 0xFF)
+      capacity = 0xFF;
+    FsmInstance* regions = (FsmInstance*) realloc(m_regions, capacity
+                                                  * sizeof(FsmInstance));
+    if (regions == NULL)
+      return false;
+    m_regions = regions;
+    m_regions_capacity = capacity;
+  }
+
+  FsmInstance* region = &m_regions[m_num_regions];
+  *region = FsmInstance(this);
+  region->m_current_state = state;
+  region->m_context = m_context;
+  region->m_owner = this;
+  m_num_regions++;
+
+  // A region added to a running machine starts with the next run.
+  Fsm::select_timers();
+  if (m_scheduler != NULL)
+    m_scheduler->invalidate(this);
+  return true;
+}
+
+
+void Fsm::set_context(void* context)
+{
+  FsmInstance::set_context(context);
+  for (int i = 0; i < m_num_regions; ++i)
+    m_regions[i].set_context(context);
+}
+
+
+void Fsm::compile()
+{
+  // Sorting moves the timed transitions, so pick the timers again.
+  FsmDefinition::compile();
+  Fsm::select_timers();
+}
+
+
+bool Fsm::begin_machine_step()
+{
+#if FSM_DEFERRED_EVENTS > 0
+  if (m_stepping)
+    return false;
+  m_stepping = true;
+#endif
+  return true;
+}
+
+
+void Fsm::end_machine_step()
+{
+  Fsm::deliver_pending();
+#if FSM_DEFERRED_EVENTS > 0
+  m_stepping = false;
+#endif
+}
+
+
+void Fsm::deliver_pending()
+{
+#if FSM_DEFERRED_EVENTS > 0
+  // Not while a handler runs, e.g. one that calls process_events().
+  if (m_busy)
+    return;
+  for (int i = 0; i < m_num_regions; ++i)
+  {
+    if (m_regions[i].m_busy)
+      return;
+  }
+
+  // Each held back event reaches every region before the next one, and
+  // events their handlers trigger are held back in turn.
+  while (m_num_pending > 0)
+  {
+    int event = m_pending[m_pending_head];
+    if (++m_pending_head == FSM_DEFERRED_EVENTS)
+      m_pending_head = 0;
+    m_num_pending--;
+    Fsm::deliver(event);
+  }
+#endif
+}
+
+
+void Fsm::defer_machine_event(int event)
+{
+#if FSM_DEFERRED_EVENTS > 0
+  if (m_num_pending == FSM_DEFERRED_EVENTS)
+  {
+#if FSM_INSTRUMENTATION
+    m_metrics.dropped_events++;
+#endif
+    return;
+  }
+
+  uint8_t tail = m_pending_head + m_num_pending;
+  if (tail >= FSM_DEFERRED_EVENTS)
+    tail -= FSM_DEFERRED_EVENTS;
+  m_pending[tail] = event;
+  m_num_pending++;
+#else
+  (void) event;
+#endif
+}
+
+
+void Fsm::deliver(int event)
+{
+  FsmInstance::trigger(event);
+  for (int i = 0; i < m_num_regions; ++i)
+    m_regions[i].trigger(event);
+}
+
+
+void Fsm::trigger(int event)
+{
+  if (!Fsm::begin_machine_step())
+  {
+    Fsm::defer_machine_event(event);
+    return;
+  }
+  Fsm::deliver(event);
+  Fsm::end_machine_step();
+}
+
+
+void Fsm::trigger_many(const int* events, size_t count)
+{
+  if (!Fsm::begin_machine_step())
+  {
+    for (size_t i = 0; i < count; ++i)
+      Fsm::defer_machine_event(events[i]);
+    return;
+  }
+  FsmInstance::trigger_many(events, count);
+  for (int i = 0; i < m_num_regions; ++i)
+    m_regions[i].trigger_many(events, count);
+  Fsm::end_machine_step();
+}
+
+
+void Fsm::wake()
+{
+  FsmInstance::wake();
+  for (int i = 0; i < m_num_regions; ++i)
+    m_regions[i].wake();
+
+  if (m_scheduler != NULL)
+    m_scheduler->mark_ready(this);
+}
+
+
+bool Fsm::has_on_state() const
+{
+  if (FsmInstance::has_on_state())
+    return true;
+  for (int i = 0; i < m_num_regions; ++i)
+  {
+    if (m_regions[i].has_on_state())
+      return true;
+  }
+  return false;
+}
+
+
+void Fsm::run_machine()
+{
+  Fsm::run_machine(FSM_CLOCK());
+}
+
+
+void Fsm::run_machine(unsigned long now)
+{
+  // Called from a handler, the step already running holds events back.
+  bool step = Fsm::begin_machine_step();
+  if (FsmInstance::start(now))
+  {
+    for (int i = 0; i < m_num_regions; ++i)
+      m_regions[i].start(now);
+    Fsm::deliver_pending();
+
+    // With a hardware timer, process_events() checks the timers when it
+    // fires instead.
+    if (m_process_events != NULL)
+      (this->*m_process_events)();
+    bool check_timers = m_hardware_timer == NULL;
+    FsmInstance::run_state(now, check_timers);
+    for (int i = 0; i < m_num_regions; ++i)
+      m_regions[i].run_state(now, check_timers);
+  }
+  if (step)
+    Fsm::end_machine_step();
+}
+
+
+void Fsm::set_trace(FsmTrace* trace, uint8_t machine)
+{
+  m_trace = trace;
+  m_trace_machine = machine;
+}
+
+
+#if FSM_PROFILING
+void Fsm::set_profile(FsmProfile* profile)
+{
+  m_profile = profile;
+}
+#endif
+
+
+void Fsm::region_started()
+{
+  // Until it starts a machine counts as polled, so its initial state gets
+  // entered; now it may be idle.
+  if (m_scheduler != NULL)
+    m_scheduler->invalidate(this);
+}
+
+
+void Fsm::transition_taken(fsm_state_t state_from,
+                           const Transition* transition)
+{
+  if (m_scheduler != NULL)
+    m_scheduler->invalidate(this);
+  Fsm::arm_timer();
+
+  if (m_trace != NULL)
+  {
+    if (FsmDefinition::is_timed(transition))
+      m_trace->record(m_trace_machine, state_from, transition->state_to,
+                      FSM_TRACE_TIMEOUT, 0);
+    else
+      m_trace->record(m_trace_machine, state_from, transition->state_to,
+                      FSM_TRACE_EVENT, transition->event);
+  }
+
+#if FSM_INSTRUMENTATION
+  if (m_metrics_hook != NULL)
+    m_metrics_hook(this, transition);
+#endif
+}
@@ -0,0 +1,853 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef FSM_H
+#define FSM_H
+
+
+#if defined(ARDUINO) && ARDUINO >= 100
+  #include <Arduino.h>
+#else
+  #include <WProgram.h>
+#endif
+
+
+// Number of bytes compile() may spend on a dense (state, event) lookup table.
+// Machines whose events do not fit use a binary search per state instead.
+#ifndef FSM_DENSE_TABLE_SIZE
+#define FSM_DENSE_TABLE_SIZE 64
+#endif
+
+// Type used to store events in the transition tables. A narrower type such
+// as int8_t shrinks every transition; events must then fit in its range.
+#ifndef FSM_EVENT_TYPE
+#define FSM_EVENT_TYPE int
+#endif
+
+// Set to 1 for builds where every byte counts: timed transitions and
+// on_state() handlers are left out, see FSM_TIMED_TRANSITIONS and
+// FSM_ON_STATE, and only states, events and their transitions remain.
+#ifndef FSM_MINIMAL
+#define FSM_MINIMAL 0
+#endif
+
+// Set to 0 to leave out timed transitions. add_timed_transition() is then
+// gone, check_timed_transitions() does nothing and images with timed
+// transitions fail to load.
+#ifndef FSM_TIMED_TRANSITIONS
+#define FSM_TIMED_TRANSITIONS !FSM_MINIMAL
+#endif
+
+// Set to 0 to leave out on_state() handlers and State::poll_interval. The
+// State constructors still take an on_state argument, which is ignored.
+#ifndef FSM_ON_STATE
+#define FSM_ON_STATE !FSM_MINIMAL
+#endif
+
+// Clock that timed transitions are measured with. With -DFSM_CLOCK=micros
+// the intervals, the now arguments and ms_until_next_timeout() are all in
+// microseconds, for timeouts below a millisecond.
+#ifndef FSM_CLOCK
+#define FSM_CLOCK millis
+#endif
+
+// Ticks of FSM_CLOCK per second. Set to 1000000 along with
+// -DFSM_CLOCK=micros.
+#ifndef FSM_CLOCK_HZ
+#define FSM_CLOCK_HZ 1000
+#endif
+
+// Clock for add_fine_timed_transition(), and its ticks per second. Fine
+// timed transitions run next to the FSM_CLOCK ones, for states that need
+// sub-millisecond timeouts while the rest keep millis(). Set
+// FSM_FINE_TIMERS to 0 to leave them out.
+#ifndef FSM_FINE_TIMERS
+#define FSM_FINE_TIMERS FSM_TIMED_TRANSITIONS
+#endif
+#if !FSM_TIMED_TRANSITIONS
+  #undef FSM_FINE_TIMERS
+  #define FSM_FINE_TIMERS 0
+#endif
+#ifndef FSM_FINE_CLOCK
+#define FSM_FINE_CLOCK micros
+#endif
+#ifndef FSM_FINE_CLOCK_HZ
+#define FSM_FINE_CLOCK_HZ 1000000
+#endif
+
+// Number of events each machine can hold back while its handlers run. An
+// event triggered from a handler is handled once the current transition
+// has finished, so handlers never nest. With 0, handlers trigger
+// transitions directly and recursively.
+#ifndef FSM_DEFERRED_EVENTS
+#define FSM_DEFERRED_EVENTS 4
+#endif
+
+// Number of events trigger_many() handles as one burst. Each costs a
+// pointer of stack; longer runs of events are split into several bursts.
+#ifndef FSM_BURST_SIZE
+#define FSM_BURST_SIZE 8
+#endif
+
+// Set to 1 (e.g. with -DFSM_INSTRUMENTATION=1) to collect transition counts,
+// state dwell times and handler durations. When 0 none of it is compiled.
+#ifndef FSM_INSTRUMENTATION
+#define FSM_INSTRUMENTATION 0
+#endif
+
+// Set to 1 to let an FsmProfile (FsmProfile.h) time every transition and
+// count the events each state receives, for tuning. When 0 none of it is
+// compiled.
+#ifndef FSM_PROFILING
+#define FSM_PROFILING 0
+#endif
+
+
+// Handlers that take the machine's context pointer (see Fsm::set_context()),
+// so one set of states and handlers can drive several machines. Wrapping
+// the pointer keeps calls that pass NULL for plain handlers unambiguous.
+struct FsmContextHandler
+{
+  FsmContextHandler(void (*function)(void*)) : function(function) {}
+  void (*function)(void*);
+};
+
+struct FsmContextGuard
+{
+  FsmContextGuard(bool (*function)(void*)) : function(function) {}
+  bool (*function)(void*);
+};
+
+
+// Set State::poll_interval to this to run on_state() only after entry and
+// when the machine is woken.
+#define FSM_POLL_ON_WAKE 0xFFFFFFFFUL
+
+// Bytes FsmInstance::snapshot() writes.
+#define FSM_SNAPSHOT_SIZE 6
+
+
+// A state may be nested in a parent state. Events the state has no
+// transition for are handled by its parent, and transitions run exit and
+// enter handlers up to and down from the innermost state containing both
+// ends. on_state() and timed transitions only apply to the current state
+// itself.
+//
+// on_state() runs on every run_machine() call unless poll_interval is set:
+// then it runs on the first call after entry, once every poll_interval
+// FSM_CLOCK() ticks and whenever the machine is woken with wake().
+struct State
+{
+  State(void (*on_enter)(), void (*on_state)(), void (*on_exit)(),
+        State* parent = NULL);
+  State(FsmContextHandler on_enter, FsmContextHandler on_state,
+        FsmContextHandler on_exit, State* parent = NULL);
+
+  // Context handlers are stored cast to void (*)() and cast back when
+  // called.
+  void (*on_enter)();
+#if FSM_ON_STATE
+  void (*on_state)();
+#endif
+  void (*on_exit)();
+  State* parent;
+#if FSM_ON_STATE
+  unsigned long poll_interval;
+#endif
+  bool takes_context;
+};
+
+
+// Returned by Fsm::ms_until_next_timeout() when no timed transition is
+// pending.
+#define FSM_NO_TIMEOUT 0xFFFFFFFFUL
+
+
+class Fsm;
+class FsmScheduler;
+class FsmTimer;
+class FsmTrace;
+class FsmProfile;
+
+
+// Index of a state within the machine it is registered with.
+typedef uint8_t fsm_state_t;
+#define FSM_NO_STATE 0xFF
+
+typedef FSM_EVENT_TYPE fsm_event_t;
+
+// Index of a callback in the machine's callback table.
+typedef uint8_t fsm_callback_t;
+#define FSM_NO_CALLBACK 0xFF
+
+// Reads one byte of a machine image, e.g. with pgm_read_byte() or from
+// EEPROM; see FsmDefinition::load().
+typedef uint8_t (*FsmReadByte)(const uint8_t* address);
+#define FSM_IMAGE_VERSION 2
+
+
+class FsmInstance;
+
+
+// The states and transitions of a machine. A definition is built once with
+// add_transition() and compile() and may then be shared by any number of
+// FsmInstance objects, which only read it.
+class FsmDefinition
+{
+public:
+  // What validate() found and optimize() removed. Shadowed transitions are
+  // never taken because an earlier transition for the same state and event
+  // always matches first, or a shorter timed transition of the same state
+  // fires first. Merged states behave exactly like another state.
+  struct Analysis
+  {
+    unsigned int shadowed_transitions;
+    unsigned int unreachable_states;
+    unsigned int merged_states;
+  };
+
+#if FSM_INSTRUMENTATION
+  struct StateMetrics
+  {
+    unsigned long dwell_ms;
+    unsigned long max_on_enter_us;
+    unsigned long max_on_state_us;
+    unsigned long max_on_exit_us;
+  };
+  struct Metrics
+  {
+    unsigned int unmatched_events;
+    unsigned int dropped_events;
+  };
+#endif
+
+  // States are numbered in the order the machine first sees them, starting
+  // with the initial state. compile() stores where each state's outgoing
+  // transitions start in the sorted tables.
+  struct StateSlot
+  {
+    State* state;
+    fsm_state_t parent;
+    int first_transition;
+#if FSM_TIMED_TRANSITIONS
+    int first_timed_transition;
+#endif
+#if FSM_INSTRUMENTATION
+    // Summed over all instances sharing the definition.
+    mutable StateMetrics metrics;
+#endif
+  };
+  // Transition handlers are stored once per machine and referenced by index,
+  // and the timer start is kept per machine, so a transition costs a few
+  // bytes.
+  // Guards and context handlers are stored as void (*)() too and cast back
+  // when called.
+  struct Callback
+  {
+    void (*function)();
+    bool takes_context;
+  };
+  struct Transition
+  {
+    fsm_event_t event;
+    fsm_state_t state_from;
+    fsm_state_t state_to;
+    fsm_callback_t on_transition;
+    fsm_callback_t guard;
+#if FSM_INSTRUMENTATION
+    mutable unsigned int fired;
+#endif
+  };
+  struct TimedTransition
+  {
+    Transition transition;
+    unsigned long interval;
+#if FSM_FINE_TIMERS
+    bool fine;
+#endif
+  };
+
+  FsmDefinition(State* initial_state);
+
+  // Use caller provided storage instead of the heap. The definition never
+  // allocates. A transition is only added if it, its states and its
+  // handler and guard all fit; without a callbacks buffer only
+  // transitions with neither can be added.
+  FsmDefinition(State* initial_state, StateSlot* states, int state_capacity,
+                Transition* transitions, int capacity,
+                TimedTransition* timed_transitions = NULL,
+                int timed_capacity = 0, Callback* callbacks = NULL,
+                int callback_capacity = 0);
+  ~FsmDefinition();
+
+  // Allocate room for the given number of transitions, states and distinct
+  // transition handlers up front. Returns false if the storage could not
+  // hold them.
+  bool reserve(int num_transitions, int num_timed_transitions = 0,
+               int num_states = 0, int num_callbacks = 0);
+
+  // Returns false and leaves the transition out if it, its states or its
+  // handler do not fit the storage.
+  bool add_transition(State* state_from, State* state_to, int event,
+                      void (*on_transition)());
+
+  // A guarded transition is only taken if guard() returns true. Transitions
+  // for the same state and event are tried in the order they were added,
+  // and if no guard passes the event bubbles up to the parent state.
+  // Guards should not have side effects.
+  bool add_transition(State* state_from, State* state_to, int event,
+                      bool (*guard)(), void (*on_transition)());
+
+#if FSM_TIMED_TRANSITIONS
+  bool add_timed_transition(State* state_from, State* state_to,
+                            unsigned long interval, void (*on_transition)());
+#endif
+
+  // The same with handlers that take the machine's context pointer.
+  bool add_transition(State* state_from, State* state_to, int event,
+                      FsmContextHandler on_transition);
+  bool add_transition(State* state_from, State* state_to, int event,
+                      FsmContextGuard guard, FsmContextHandler on_transition);
+#if FSM_TIMED_TRANSITIONS
+  bool add_timed_transition(State* state_from, State* state_to,
+                            unsigned long interval,
+                            FsmContextHandler on_transition);
+#endif
+
+#if FSM_FINE_TIMERS
+  // A timed transition measured in FSM_FINE_CLOCK() ticks, microseconds by
+  // default. It is armed on entry like any other; of a state's fine timed
+  // transitions the shortest fires, and it may fire before or after the
+  // state's FSM_CLOCK ones. How close to the deadline it fires depends on
+  // how often the machine is checked.
+  bool add_fine_timed_transition(State* state_from, State* state_to,
+                                 unsigned long interval,
+                                 void (*on_transition)());
+  bool add_fine_timed_transition(State* state_from, State* state_to,
+                                 unsigned long interval,
+                                 FsmContextHandler on_transition);
+#endif
+
+  // Group the transition tables by source state and sort each group by
+  // event, so trigger() and timed transitions only look at the current
+  // state's edges. Transitions added afterwards disable the compiled lookup
+  // until compile() is called again.
+  void compile();
+
+  // Replace the states and transitions with a machine image of size bytes
+  // written by extras/tools/fsm_compile.py. The image numbers states and
+  // handlers: states[i] is state i, the initial state is state 0, and
+  // handlers[i] is handler i (guards cast to void (*)()). Its tables are
+  // already grouped by state and sorted, so loading fills each table in one
+  // pass and leaves the definition compiled. The image is read through
+  // read_byte, plain memory by default, and need not stay around afterwards.
+  //
+  // Loading copies: the tables are decoded into the definition's storage,
+  // the heap unless caller provided, and take the same RAM as a machine
+  // built with add_transition(). The image itself, e.g. in PROGMEM, is
+  // only read while loading.
+  //
+  // Returns false and leaves the definition alone if the image is
+  // malformed or shorter than its header says, refers to more states or
+  // handlers than given, or does not fit the storage. Load the image
+  // before any instance runs.
+  bool load(const uint8_t* image, size_t size, State* const* states,
+            int num_states, void (* const* handlers)(), int num_handlers,
+            FsmReadByte read_byte = NULL);
+
+  // Compile the definition and look for transitions that are never taken,
+  // states that cannot be reached from the initial state and states that
+  // could be merged. Needs three bytes per state of heap while it runs and
+  // returns false if they are not available.
+  bool validate(Analysis* analysis);
+
+  // Apply what validate() finds: drop shadowed transitions and those of
+  // unreachable states, and point transitions to a merged state at the
+  // state it behaves like. State numbers stay the same. States are only
+  // merged when they have the same handlers, parent and transitions, are
+  // nobody's parent and not where a machine starts; their metrics and
+  // trace records are then those of the state they were merged into. Call
+  // it before any instance runs.
+  bool optimize(Analysis* analysis = NULL);
+
+#if defined(pgm_read_byte)
+  // For load() from PROGMEM.
+  static uint8_t read_progmem(const uint8_t* address);
+#endif
+
+#if FSM_INSTRUMENTATION
+  const Metrics& metrics() const;
+
+  // NULL if the state is not part of this machine.
+  const StateMetrics* state_metrics(State* state) const;
+#endif
+
+private:
+  friend class ConcurrentFsm;
+  friend class FsmInstance;
+  friend class Fsm;
+  friend class FsmProfile;
+
+  bool add_transition(State* state_from, State* state_to, int event,
+                      void (*guard)(), void (*on_transition)(),
+                      bool takes_context);
+#if FSM_TIMED_TRANSITIONS
+  bool add_timed_transition(State* state_from, State* state_to,
+                            unsigned long interval, void (*on_transition)(),
+                            bool takes_context, bool fine = false);
+#endif
+
+  static Transition create_transition(fsm_state_t state_from,
+                                      fsm_state_t state_to, int event,
+                                      fsm_callback_t on_transition);
+
+  bool reserve_states(int capacity);
+  bool reserve_callbacks(int capacity);
+  bool reserve_transitions(int capacity);
+#if FSM_TIMED_TRANSITIONS
+  bool reserve_timed_transitions(int capacity);
+#endif
+  fsm_state_t register_state(State* state);
+  bool register_callback(void (*function)(), bool takes_context,
+                         fsm_callback_t* callback);
+
+  static bool transition_less(const Transition& a, const Transition& b);
+  void compile_dense_table();
+  bool check_image(const uint8_t* image, size_t size, State* const* states,
+                   int num_states, void (* const* handlers)(),
+                   int num_handlers, FsmReadByte read_byte) const;
+
+  int transitions_end(fsm_state_t state) const;
+#if FSM_TIMED_TRANSITIONS
+  int timed_transitions_end(fsm_state_t state) const;
+  int first_timer(fsm_state_t state, bool fine = false) const;
+#endif
+
+  bool is_shadowed(int index, int first) const;
+  bool same_behavior(fsm_state_t a, fsm_state_t b,
+                     const uint8_t* classes) const;
+  void mark_reachable(fsm_state_t state, uint8_t* reachable,
+                      bool* changed) const;
+  void analyze(fsm_state_t root, const FsmInstance* regions,
+               int num_regions, uint8_t* buffer, Analysis* analysis) const;
+  bool optimize(fsm_state_t root, const FsmInstance* regions,
+                int num_regions, Analysis* analysis, bool apply);
+
+  bool is_timed(const Transition* transition) const;
+  bool is_ancestor(fsm_state_t ancestor, fsm_state_t state) const;
+  fsm_state_t common_ancestor(fsm_state_t state_from,
+                              fsm_state_t state_to) const;
+
+private:
+  StateSlot* m_states;
+  int m_num_states;
+  int m_states_capacity;
+
+  Transition* m_transitions;
+  int m_num_transitions;
+  int m_transitions_capacity;
+
+#if FSM_TIMED_TRANSITIONS
+  TimedTransition* m_timed_transitions;
+  int m_num_timed_transitions;
+  int m_timed_transitions_capacity;
+#endif
+
+  Callback* m_callbacks;
+  int m_num_callbacks;
+  int m_callbacks_capacity;
+
+  // Bucket relative index + 1 of the first transition for each (state,
+  // event - m_dense_event_min) pair, 0 for none. NULL when not used.
+  uint8_t* m_dense;
+  int m_dense_event_min;
+  int m_dense_event_span;
+
+#if FSM_INSTRUMENTATION
+  mutable Metrics m_metrics;
+#endif
+
+  bool m_owns_storage;
+  bool m_compiled;
+};
+
+
+// The running state of one machine over a shared definition: the current
+// state, whether it has started and its timer. The definition should be
+// complete before the instance first runs.
+//
+//   FsmDefinition channel(&state_idle);
+//   FsmInstance channels[NUM_CHANNELS];
+//
+//   for (int i = 0; i < NUM_CHANNELS; ++i)
+//     channels[i].set_definition(&channel);
+class FsmInstance
+{
+public:
+  FsmInstance(const FsmDefinition* definition = NULL);
+
+  // Start over in the definition's initial state.
+  void set_definition(const FsmDefinition* definition);
+
+  // Passed to every context handler of this machine.
+  void set_context(void* context);
+  void* get_context() const;
+
+  void check_timed_transitions();
+  void check_timed_transitions(unsigned long now);
+
+  // Milliseconds until the next timed transition of the current state is
+  // due, or its on_state() handler is next polled, 0 if that is already the
+  // case or FSM_NO_TIMEOUT if there is nothing pending. A sketch without
+  // on_state() handlers polled on every call can sleep this long between
+  // run_machine() calls.
+  unsigned long ms_until_next_timeout();
+  unsigned long ms_until_next_timeout(unsigned long now);
+
+  // Store the FSM_CLOCK() value at which the next timed transition is due.
+  // Returns false if no timed transition is pending.
+  bool next_deadline(unsigned long* deadline);
+
+  // Called from one of the machine's own handlers, the event is queued and
+  // handled after the current transition (see FSM_DEFERRED_EVENTS).
+  void trigger(int event);
+
+  // Trigger a burst of events in order. Each transition's handler runs, but
+  // the states passed through on the way are not entered or exited: only
+  // the exit handlers of the current state and the enter handlers of the
+  // final state run, and timed transitions are re-armed once. All guards
+  // of a burst are called before its first handler runs, so they do not
+  // see what the handlers of earlier events in the burst change. Every
+  // FSM_BURST_SIZE events start a new burst.
+  void trigger_many(const int* events, size_t count);
+
+  void run_machine();
+
+  // Run the machine with an FSM_CLOCK() value the caller has already read.
+  void run_machine(unsigned long now);
+
+  // Run on_state() of a state with a poll_interval on the next
+  // run_machine() call, e.g. from a pin change interrupt handler.
+  void wake();
+
+  // Write the current state, whether the machine has started and how long
+  // its timer has been running into FSM_SNAPSHOT_SIZE bytes, e.g. for RTC
+  // RAM or EEPROM. Not to be called from the machine's own handlers.
+  void snapshot(uint8_t* buffer) const;
+
+  // Continue where a snapshot of the same definition left off, without
+  // running any handlers. States are numbered in the order they were first
+  // added, so the definition must be built the same way. Returns false and
+  // leaves the machine alone if the snapshot does not fit the definition.
+  bool restore(const uint8_t* buffer);
+
+protected:
+  friend class Fsm;
+  friend class FsmDefinition;
+  friend class FsmScheduler;
+
+  typedef FsmDefinition::StateSlot StateSlot;
+  typedef FsmDefinition::Callback Callback;
+  typedef FsmDefinition::Transition Transition;
+  typedef FsmDefinition::TimedTransition TimedTransition;
+
+  // Run the initial state's on_enter() handler and arm its timer on the
+  // first call. Returns false if there is no state to run.
+  bool start(unsigned long now);
+  void run_state(unsigned long now, bool check_timers = true);
+
+  // Handlers run between begin_step() and end_step(). begin_step() returns
+  // false if a step is already running, end_step() handles the events
+  // deferred meanwhile.
+  bool begin_step();
+  void end_step();
+  void defer(int event);
+  void dispatch(int event);
+  void run_burst(const int* events, size_t count);
+
+  void call_handler(const State* state, void (*handler)());
+  bool guard_passes(const Transition* transition);
+  const Transition* find_transition(fsm_state_t state, int event);
+  const Transition* lookup_transition(fsm_state_t state, int event);
+  void select_timer();
+  bool can_restore(const uint8_t* buffer) const;
+#if FSM_ON_STATE
+  bool poll_due(const State* state, unsigned long now);
+#endif
+  unsigned long ms_until_next_poll(unsigned long now) const;
+  unsigned long us_until_next_timer(unsigned long now) const;
+  void exit_states(fsm_state_t ancestor);
+  void enter_states(fsm_state_t ancestor, fsm_state_t state);
+  void run_transition_handler(const Transition* transition);
+  void finish_transition(const Transition* transition);
+  void make_transition(const Transition* transition);
+  bool has_on_state() const;
+
+#if FSM_INSTRUMENTATION
+  void measure(const State* state, void (*handler)(),
+               unsigned long* worst_us);
+#endif
+
+protected:
+  const FsmDefinition* m_definition;
+  void* m_context;
+
+  // Timed transition of the current state with the earliest deadline, or -1,
+  // and the time the state was entered. The timer is armed on entry; only
+  // a machine that has not been run yet arms it on the first check.
+#if FSM_TIMED_TRANSITIONS
+  int m_timer;
+  unsigned long m_timer_start;
+  bool m_timer_armed;
+#endif
+
+#if FSM_FINE_TIMERS
+  // The same for fine timed transitions, in FSM_FINE_CLOCK() ticks. Armed
+  // along with m_timer.
+  int m_fine_timer;
+  unsigned long m_fine_timer_start;
+#endif
+
+#if FSM_ON_STATE
+  // When on_state() last ran, for states with a poll_interval.
+  unsigned long m_last_poll;
+  volatile bool m_woken;
+#endif
+
+#if FSM_INSTRUMENTATION
+  unsigned long m_entered;
+#endif
+
+#if FSM_DEFERRED_EVENTS > 0
+  fsm_event_t m_deferred[FSM_DEFERRED_EVENTS];
+  uint8_t m_deferred_head;
+  uint8_t m_num_deferred;
+  bool m_busy;
+#endif
+
+  fsm_state_t m_current_state;
+  bool m_initialized;
+
+  // The Fsm this instance is, or is a region of, which is told about every
+  // transition. NULL for a standalone instance.
+  Fsm* m_owner;
+};
+
+
+// A machine with its own definition, plus an event queue, scheduling with
+// FsmScheduler, tracing and a metrics hook.
+//
+// A machine may have orthogonal regions: independent parts that are each in
+// one of their own states at the same time. The initial state passed to the
+// constructor starts the first region and add_region() starts another one.
+// Every event goes to all regions, which share the compiled dispatch
+// tables, and the machine's timeout is the earliest of all regions. An
+// event triggered from any region's handler is held back by the machine
+// until the current event has reached every region.
+class Fsm : public FsmDefinition, public FsmInstance
+{
+public:
+  using FsmDefinition::StateSlot;
+  using FsmDefinition::Callback;
+  using FsmDefinition::Transition;
+  using FsmDefinition::TimedTransition;
+
+  Fsm(State* initial_state);
+
+  // Use caller provided storage instead of the heap, as for FsmDefinition:
+  // transitions with a handler or guard need the callbacks buffer.
+  Fsm(State* initial_state, StateSlot* states, int state_capacity,
+      Transition* transitions, int capacity,
+      TimedTransition* timed_transitions = NULL, int timed_capacity = 0,
+      Callback* callbacks = NULL, int callback_capacity = 0);
+  ~Fsm();
+
+  // Start another region in the given state. Its states and transitions are
+  // added like any other, but must not be shared with other regions.
+  // Returns false if the state or region could not be stored; machines
+  // using caller provided storage have a single region.
+  bool add_region(State* initial_state);
+
+  void set_context(void* context);
+
+  // Unlike a shared definition, an Fsm may gain timed transitions and be
+  // compiled while running; its timer follows.
+#if FSM_TIMED_TRANSITIONS
+  bool add_timed_transition(State* state_from, State* state_to,
+                            unsigned long interval, void (*on_transition)());
+  bool add_timed_transition(State* state_from, State* state_to,
+                            unsigned long interval,
+                            FsmContextHandler on_transition);
+#endif
+#if FSM_FINE_TIMERS
+  bool add_fine_timed_transition(State* state_from, State* state_to,
+                                 unsigned long interval,
+                                 void (*on_transition)());
+  bool add_fine_timed_transition(State* state_from, State* state_to,
+                                 unsigned long interval,
+                                 FsmContextHandler on_transition);
+#endif
+  void compile();
+
+  // Regions start in states of their own, so these count states reachable
+  // from any region's current state. optimize() also picks the timers
+  // again.
+  bool validate(Analysis* analysis);
+  bool optimize(Analysis* analysis = NULL);
+
+  void check_timed_transitions();
+  void check_timed_transitions(unsigned long now);
+
+  unsigned long ms_until_next_timeout();
+  unsigned long ms_until_next_timeout(unsigned long now);
+
+  // The same over a group of machines: the shortest wait of all of them.
+  static unsigned long ms_until_next_timeout(Fsm* const* machines, int count);
+
+  bool next_deadline(unsigned long* deadline);
+
+  void trigger(int event);
+  void trigger_many(const int* events, size_t count);
+
+  // Wake every region. Safe to call from an interrupt handler.
+  void wake();
+
+  // Bytes snapshot() writes: a region count and a FsmInstance snapshot of
+  // every region.
+  size_t snapshot_size() const;
+  size_t snapshot(uint8_t* buffer) const;
+
+  // Restore every region. Returns false and leaves the machine alone if the
+  // snapshot was taken with a different number of regions or states.
+  bool restore(const uint8_t* buffer);
+
+  void run_machine();
+
+  // Run the machine with an FSM_CLOCK() value the caller has already read.
+  void run_machine(unsigned long now);
+
+  // Give the machine a ring buffer for post(). It holds size - 1 events;
+  // with a size below 2 the machine has no queue and post() fails.
+  void set_event_queue(volatile int* buffer, uint8_t size);
+
+  // Queue an event for the next run_machine() or process_events() call.
+  // Safe to call from one interrupt handler (or other single producer)
+  // without disabling interrupts. Returns false if the queue is full and
+  // the event was dropped.
+  bool post(int event);
+
+  // Trigger the events posted so far, in order. Events posted while this
+  // runs are left for the next call.
+  void process_events();
+
+  // Record every transition of this machine in the trace, tagged with the
+  // given id. NULL stops recording.
+  void set_trace(FsmTrace* trace, uint8_t machine = 0);
+
+#if FSM_INSTRUMENTATION
+  // Called after every transition, e.g. to stream the counters over serial.
+  typedef void (*MetricsHook)(Fsm* fsm, const Transition* transition);
+  void set_metrics_hook(MetricsHook hook);
+#endif
+
+#if FSM_PROFILING
+  // Profile the events of this machine and all its regions. NULL stops
+  // profiling.
+  void set_profile(FsmProfile* profile);
+#endif
+
+private:
+  friend class ConcurrentFsm;
+  friend class FsmInstance;
+  friend class FsmScheduler;
+  friend class FsmTimer;
+
+  void transition_taken(fsm_state_t state_from,
+                        const Transition* transition);
+  void region_started();
+
+  // Like FsmInstance::begin_step() and end_step(), over all regions.
+  // deliver() hands an event to every region, deliver_pending() the events
+  // held back so far.
+  bool begin_machine_step();
+  void end_machine_step();
+  void deliver_pending();
+  void defer_machine_event(int event);
+  void deliver(int event);
+  void select_timers();
+  void arm_timer();
+  void timer_fired();
+  unsigned long us_until_next_timer() const;
+  bool optimize(Analysis* analysis, bool apply);
+  bool has_on_state() const;
+
+private:
+  // Single producer, single consumer: post() only writes m_queue_head and
+  // process_events() only writes m_queue_tail.
+  volatile int* m_queue;
+  uint8_t m_queue_size;
+  volatile uint8_t m_queue_head;
+  volatile uint8_t m_queue_tail;
+
+  // Set by FsmScheduler::add(). m_next_ready links the scheduler's list of
+  // machines with posted events and m_next_stale its list of machines that
+  // took a transition; m_slot and m_deadline are the machine's place in the
+  // scheduler.
+  FsmScheduler* m_scheduler;
+  Fsm* volatile m_next_ready;
+  volatile bool m_ready;
+  bool m_stale;
+  Fsm* m_next_stale;
+  int m_slot;
+  unsigned long m_deadline;
+
+  FsmTrace* m_trace;
+  uint8_t m_trace_machine;
+
+#if FSM_DEFERRED_EVENTS > 0
+  // Events triggered while a step of any region runs.
+  fsm_event_t m_pending[FSM_DEFERRED_EVENTS];
+  uint8_t m_pending_head;
+  uint8_t m_num_pending;
+  bool m_stepping;
+#endif
+
+  // process_events(), once set_event_queue() or FsmTimer::begin() gives it
+  // something to do, or a subclass's own that also calls it. run_machine()
+  // and FsmScheduler call it through this pointer so that sketches using
+  // neither do not link the queue.
+  void (Fsm::*m_process_events)();
+
+  // Set by FsmTimer::begin(). The timer interrupt sets m_timeout_due, and
+  // the timers are only checked then.
+  FsmTimer* m_hardware_timer;
+  volatile bool m_timeout_due;
+
+  // Regions after the first, which is the machine's own instance.
+  FsmInstance* m_regions;
+  uint8_t m_num_regions;
+  uint8_t m_regions_capacity;
+
+#if FSM_INSTRUMENTATION
+  MetricsHook m_metrics_hook;
+#endif
+
+#if FSM_PROFILING
+  FsmProfile* m_profile;
+#endif
+};
+
+
+#endif
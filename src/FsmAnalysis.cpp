@@ -0,0 +1,363 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "Fsm.h"
+
+
+bool FsmDefinition::validate(Analysis* analysis)
+{
+  return FsmDefinition::optimize(0, NULL, 0, analysis, false);
+}
+
+bool FsmDefinition::optimize(Analysis* analysis)
+{
+  return FsmDefinition::optimize(0, NULL, 0, analysis, true);
+}
+
+bool FsmDefinition::is_shadowed(int index, int first) const
+{
+  // In a compiled group an earlier transition for the same event is tried
+  // first, and wins unless its guard can fail where this one's passes.
+  const Transition* transition = &m_transitions[index];
+  for (int i = first; i < index; ++i)
+  {
+    if (m_transitions[i].event == transition->event &&
+        (m_transitions[i].guard == FSM_NO_CALLBACK ||
+         m_transitions[i].guard == transition->guard))
+      return true;
+  }
+  return false;
+}
+
+bool FsmDefinition::same_behavior(fsm_state_t a, fsm_state_t b,
+                                  const uint8_t* classes) const
+{
+  int first_a = m_states[a].first_transition;
+  int first_b = m_states[b].first_transition;
+  int end_a = FsmDefinition::transitions_end(a);
+  int end_b = FsmDefinition::transitions_end(b);
+  int i = first_a;
+  int j = first_b;
+  for (;;)
+  {
+    while (i < end_a && FsmDefinition::is_shadowed(i, first_a))
+      ++i;
+    while (j < end_b && FsmDefinition::is_shadowed(j, first_b))
+      ++j;
+    if (i == end_a || j == end_b)
+      break;
+
+    const Transition* x = &m_transitions[i++];
+    const Transition* y = &m_transitions[j++];
+    if (x->event != y->event || x->guard != y->guard ||
+        x->on_transition != y->on_transition ||
+        classes[x->state_to] != classes[y->state_to])
+      return false;
+  }
+  if (i != end_a || j != end_b)
+    return false;
+
+#if FSM_TIMED_TRANSITIONS
+  for (int fine = 0; fine < 2; ++fine)
+  {
+    int timer_a = FsmDefinition::first_timer(a, fine);
+    int timer_b = FsmDefinition::first_timer(b, fine);
+    if (timer_a < 0 || timer_b < 0)
+    {
+      if (timer_a != timer_b)
+        return false;
+      continue;
+    }
+
+    const TimedTransition* x = &m_timed_transitions[timer_a];
+    const TimedTransition* y = &m_timed_transitions[timer_b];
+    if (x->interval != y->interval ||
+        x->transition.on_transition != y->transition.on_transition ||
+        classes[x->transition.state_to] != classes[y->transition.state_to])
+      return false;
+  }
+#endif
+  return true;
+}
+
+void FsmDefinition::mark_reachable(fsm_state_t state, uint8_t* reachable,
+                                   bool* changed) const
+{
+  // Being in a state means being in all its parents too.
+  for (; state != FSM_NO_STATE && !reachable[state];
+       state = m_states[state].parent)
+  {
+    reachable[state] = 1;
+    *changed = true;
+  }
+}
+
+void FsmDefinition::analyze(fsm_state_t root, const FsmInstance* regions,
+                            int num_regions, uint8_t* buffer,
+                            Analysis* analysis) const
+{
+  int n = m_num_states;
+  uint8_t* classes = buffer;
+  uint8_t* next = buffer + n;
+  uint8_t* fixed = buffer + 2 * n;
+
+  // States that are a parent or where a machine starts keep their own
+  // class; the others start out grouped by their State fields.
+  memset(fixed, 0, n);
+  fixed[root] = 1;
+  for (int i = 0; i < num_regions; ++i)
+    fixed[regions[i].m_current_state] = 1;
+  for (int i = 0; i < n; ++i)
+  {
+    if (m_states[i].parent != FSM_NO_STATE)
+      fixed[m_states[i].parent] = 1;
+  }
+
+  for (int i = 0; i < n; ++i)
+  {
+    const StateSlot* slot = &m_states[i];
+    classes[i] = i;
+    for (int j = 0; j < i && !fixed[i]; ++j)
+    {
+      const StateSlot* other = &m_states[j];
+      if (!fixed[j] && classes[j] == j &&
+          slot->parent == other->parent &&
+          slot->state->on_enter == other->state->on_enter &&
+#if FSM_ON_STATE
+          slot->state->on_state == other->state->on_state &&
+          slot->state->poll_interval == other->state->poll_interval &&
+#endif
+          slot->state->on_exit == other->state->on_exit &&
+          slot->state->takes_context == other->state->takes_context)
+      {
+        classes[i] = j;
+        break;
+      }
+    }
+  }
+
+  // Split classes until every member behaves like the lowest numbered one
+  // under the current classes.
+  bool changed = true;
+  while (changed)
+  {
+    for (int i = 0; i < n; ++i)
+    {
+      next[i] = i;
+      for (int j = 0; j < i; ++j)
+      {
+        if (next[j] == j && classes[j] == classes[i] &&
+            FsmDefinition::same_behavior(j, i, classes))
+        {
+          next[i] = j;
+          break;
+        }
+      }
+    }
+    changed = memcmp(classes, next, n) != 0;
+    memcpy(classes, next, n);
+  }
+
+  // Follow the transitions that can be taken, into merged states' classes.
+  uint8_t* reachable = fixed;
+  memset(reachable, 0, n);
+  FsmDefinition::mark_reachable(root, reachable, &changed);
+  for (int i = 0; i < num_regions; ++i)
+    FsmDefinition::mark_reachable(regions[i].m_current_state, reachable,
+                                  &changed);
+  while (changed)
+  {
+    changed = false;
+    for (int i = 0; i < n; ++i)
+    {
+      if (!reachable[i])
+        continue;
+      int first = m_states[i].first_transition;
+      for (int j = first; j < FsmDefinition::transitions_end(i); ++j)
+      {
+        if (!FsmDefinition::is_shadowed(j, first))
+          FsmDefinition::mark_reachable(classes[m_transitions[j].state_to],
+                                        reachable, &changed);
+      }
+#if FSM_TIMED_TRANSITIONS
+      for (int fine = 0; fine < 2; ++fine)
+      {
+        int timer = FsmDefinition::first_timer(i, fine);
+        if (timer >= 0)
+          FsmDefinition::mark_reachable(
+              classes[m_timed_transitions[timer].transition.state_to],
+              reachable, &changed);
+      }
+#endif
+    }
+  }
+
+  memset(analysis, 0, sizeof(*analysis));
+  for (int i = 0; i < n; ++i)
+  {
+    int first = m_states[i].first_transition;
+    for (int j = first; j < FsmDefinition::transitions_end(i); ++j)
+    {
+      if (FsmDefinition::is_shadowed(j, first))
+        analysis->shadowed_transitions++;
+    }
+#if FSM_TIMED_TRANSITIONS
+    int timed = FsmDefinition::timed_transitions_end(i)
+                - m_states[i].first_timed_transition;
+    for (int fine = 0; fine < 2; ++fine)
+    {
+      if (FsmDefinition::first_timer(i, fine) >= 0)
+        --timed;
+    }
+    analysis->shadowed_transitions += timed;
+#endif
+
+    if (classes[i] != i)
+      analysis->merged_states++;
+    else if (!reachable[i])
+      analysis->unreachable_states++;
+  }
+}
+
+bool FsmDefinition::optimize(fsm_state_t root, const FsmInstance* regions,
+                             int num_regions, Analysis* analysis, bool apply)
+{
+  FsmDefinition::compile();
+
+  Analysis result;
+  memset(&result, 0, sizeof(result));
+  int n = m_num_states;
+  uint8_t* buffer = NULL;
+  if (n > 0)
+  {
+    buffer = (uint8_t*) malloc(3 * n);
+    if (buffer == NULL)
+      return false;
+    FsmDefinition::analyze(root, regions, num_regions, buffer, &result);
+  }
+
+  if (apply && n > 0)
+  {
+    const uint8_t* classes = buffer;
+    const uint8_t* reachable = buffer + 2 * n;
+
+    // Compact both tables in place; a group is only ever moved down, and
+    // each state's old bounds are read before they are overwritten.
+    int count = 0;
+#if FSM_TIMED_TRANSITIONS
+    int timed_count = 0;
+#endif
+    for (int i = 0; i < n; ++i)
+    {
+      int begin = m_states[i].first_transition;
+      int end = FsmDefinition::transitions_end(i);
+#if FSM_TIMED_TRANSITIONS
+      int timers[2] = { FsmDefinition::first_timer(i, false),
+                        FsmDefinition::first_timer(i, true) };
+#endif
+      bool keep = classes[i] == i && reachable[i];
+
+      m_states[i].first_transition = count;
+      for (int j = begin; keep && j < end; ++j)
+      {
+        Transition transition = m_transitions[j];
+        transition.state_to = classes[transition.state_to];
+        m_transitions[count] = transition;
+        if (!FsmDefinition::is_shadowed(count,
+                                        m_states[i].first_transition))
+          ++count;
+      }
+
+#if FSM_TIMED_TRANSITIONS
+      // Copy the timers in table order, so neither is overwritten before
+      // it is copied.
+      m_states[i].first_timed_transition = timed_count;
+      if (timers[1] >= 0 && timers[1] < timers[0])
+      {
+        int fine_timer = timers[1];
+        timers[1] = timers[0];
+        timers[0] = fine_timer;
+      }
+      for (int k = 0; keep && k < 2; ++k)
+      {
+        int index = timers[k];
+        if (index < 0)
+          continue;
+        TimedTransition timed_transition = m_timed_transitions[index];
+        timed_transition.transition.state_to =
+            classes[timed_transition.transition.state_to];
+        m_timed_transitions[timed_count++] = timed_transition;
+      }
+#endif
+    }
+    m_num_transitions = count;
+#if FSM_TIMED_TRANSITIONS
+    m_num_timed_transitions = timed_count;
+#endif
+
+    // Give back what the tables no longer need.
+    if (m_owns_storage && count > 0 && count < m_transitions_capacity)
+    {
+      Transition* transitions = (Transition*) realloc(m_transitions, count
+                                                      * sizeof(Transition));
+      if (transitions != NULL)
+      {
+        m_transitions = transitions;
+        m_transitions_capacity = count;
+      }
+    }
+#if FSM_TIMED_TRANSITIONS
+    if (m_owns_storage && timed_count > 0 &&
+        timed_count < m_timed_transitions_capacity)
+    {
+      TimedTransition* timed_transitions = (TimedTransition*) realloc(
+          m_timed_transitions, timed_count * sizeof(TimedTransition));
+      if (timed_transitions != NULL)
+      {
+        m_timed_transitions = timed_transitions;
+        m_timed_transitions_capacity = timed_count;
+      }
+    }
+#endif
+    FsmDefinition::compile_dense_table();
+  }
+
+  free(buffer);
+  if (analysis != NULL)
+    *analysis = result;
+  return true;
+}
+
+
+bool Fsm::validate(Analysis* analysis)
+{
+  return Fsm::optimize(analysis, false);
+}
+
+
+bool Fsm::optimize(Analysis* analysis)
+{
+  return Fsm::optimize(analysis, true);
+}
+
+
+bool Fsm::optimize(Analysis* analysis, bool apply)
+{
+  // The tables move, so pick the timers again.
+  bool ok = FsmDefinition::optimize(m_current_state, m_regions,
+                                    m_num_regions, analysis, apply);
+  Fsm::select_timers();
+  return ok;
+}
@@ -0,0 +1,229 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "Fsm.h"
+
+
+// Machine image layout, all little endian: a header, then per state its
+// parent and the first of its transitions and timed transitions, per
+// handler its flags, then the transitions and timed transitions grouped by
+// state. Transitions do not store their source state; it follows from the
+// groups. Bit 0 of a timed transition's flags marks a fine one.
+#define FSM_IMAGE_HEADER_SIZE 12
+#define FSM_IMAGE_STATE_SIZE 5
+#define FSM_IMAGE_TRANSITION_SIZE 5
+#define FSM_IMAGE_TIMED_TRANSITION_SIZE 7
+
+static uint8_t read_memory(const uint8_t* address)
+{
+  return *address;
+}
+
+static unsigned long read_image(FsmReadByte read_byte, const uint8_t* address,
+                                int size)
+{
+  unsigned long value = 0;
+  for (int i = 0; i < size; ++i)
+    value |= (unsigned long) read_byte(address + i) << (8 * i);
+  return value;
+}
+
+#if defined(pgm_read_byte)
+uint8_t FsmDefinition::read_progmem(const uint8_t* address)
+{
+  return pgm_read_byte(address);
+}
+#endif
+
+bool FsmDefinition::check_image(const uint8_t* image, size_t size,
+                                State* const* states, int num_states,
+                                void (* const* handlers)(), int num_handlers,
+                                FsmReadByte read_byte) const
+{
+  if (size < FSM_IMAGE_HEADER_SIZE || read_byte(image) != 'F' || read_byte(image + 1) != 'S' ||
+      read_byte(image + 2) != 'M' || read_byte(image + 3) != 'B' ||
+      read_byte(image + 4) != FSM_IMAGE_VERSION)
+    return false;
+
+  int n = read_byte(image + 5);
+  int c = read_byte(image + 6);
+  int t = read_image(read_byte, image + 8, 2);
+  int tt = read_image(read_byte, image + 10, 2);
+  if (n == 0 || n == FSM_NO_STATE || n > num_states ||
+      c == FSM_NO_CALLBACK || c > num_handlers)
+    return false;
+
+  // Nothing past the header is read before the tables are known to fit.
+  unsigned long length = FSM_IMAGE_HEADER_SIZE
+                         + (unsigned long) n * FSM_IMAGE_STATE_SIZE + c
+                         + (unsigned long) t * FSM_IMAGE_TRANSITION_SIZE
+                         + (unsigned long) tt
+                           * FSM_IMAGE_TIMED_TRANSITION_SIZE;
+  if (size < length)
+    return false;
+
+  const uint8_t* state_table = image + FSM_IMAGE_HEADER_SIZE;
+  const uint8_t* transitions = state_table + n * FSM_IMAGE_STATE_SIZE + c;
+  const uint8_t* timed_transitions = transitions
+                                     + t * FSM_IMAGE_TRANSITION_SIZE;
+  for (int i = 0; i < c; ++i)
+  {
+    if (handlers[i] == NULL)
+      return false;
+  }
+
+  for (int i = 0; i < n; ++i)
+  {
+    const uint8_t* entry = state_table + i * FSM_IMAGE_STATE_SIZE;
+    if (states[i] == NULL)
+      return false;
+
+    // Parents must exist and must not loop.
+    int parent = read_byte(entry);
+    for (int depth = 0; parent != FSM_NO_STATE; ++depth)
+    {
+      if (parent >= n || depth == n)
+        return false;
+      parent = read_byte(state_table + parent * FSM_IMAGE_STATE_SIZE);
+    }
+
+    int first = read_image(read_byte, entry + 1, 2);
+    int first_timed = read_image(read_byte, entry + 3, 2);
+    int end = t;
+    int end_timed = tt;
+    if (i + 1 < n)
+    {
+      end = read_image(read_byte, entry + FSM_IMAGE_STATE_SIZE + 1, 2);
+      end_timed = read_image(read_byte, entry + FSM_IMAGE_STATE_SIZE + 3, 2);
+    }
+    if ((i == 0 && (first != 0 || first_timed != 0)) ||
+        first > end || end > t || first_timed > end_timed || end_timed > tt)
+      return false;
+
+    // Events are sorted within a state for the binary search.
+    for (int j = first; j < end; ++j)
+    {
+      const uint8_t* edge = transitions + j * FSM_IMAGE_TRANSITION_SIZE;
+      int on_transition = read_byte(edge + 3);
+      int guard = read_byte(edge + 4);
+      if (read_byte(edge + 2) >= n ||
+          (on_transition >= c && on_transition != FSM_NO_CALLBACK) ||
+          (guard >= c && guard != FSM_NO_CALLBACK))
+        return false;
+      if (j > first &&
+          (int16_t) read_image(read_byte, edge, 2) <
+          (int16_t) read_image(read_byte,
+                               edge - FSM_IMAGE_TRANSITION_SIZE, 2))
+        return false;
+    }
+  }
+
+  for (int j = 0; j < tt; ++j)
+  {
+    const uint8_t* edge = timed_transitions
+                          + j * FSM_IMAGE_TIMED_TRANSITION_SIZE;
+    int on_transition = read_byte(edge + 5);
+    if (read_byte(edge + 4) >= n ||
+        (on_transition >= c && on_transition != FSM_NO_CALLBACK) ||
+        (read_byte(edge + 6) & ~(FSM_FINE_TIMERS ? 1 : 0)) != 0)
+      return false;
+  }
+  return true;
+}
+
+bool FsmDefinition::load(const uint8_t* image, size_t size,
+                         State* const* states, int num_states,
+                         void (* const* handlers)(), int num_handlers,
+                         FsmReadByte read_byte)
+{
+  if (read_byte == NULL)
+    read_byte = &read_memory;
+
+  // Check the whole image before changing anything.
+  if (!FsmDefinition::check_image(image, size, states, num_states,
+                                  handlers, num_handlers, read_byte))
+    return false;
+
+  int n = read_byte(image + 5);
+  int c = read_byte(image + 6);
+  int t = read_image(read_byte, image + 8, 2);
+  int tt = read_image(read_byte, image + 10, 2);
+  // Without FSM_TIMED_TRANSITIONS there is no room for any timed ones.
+  if (!FsmDefinition::reserve(t, tt, n, c))
+    return false;
+
+  const uint8_t* entry = image + FSM_IMAGE_HEADER_SIZE;
+  for (int i = 0; i < n; ++i, entry += FSM_IMAGE_STATE_SIZE)
+  {
+    StateSlot* slot = &m_states[i];
+    slot->state = states[i];
+    slot->parent = read_byte(entry);
+    slot->first_transition = read_image(read_byte, entry + 1, 2);
+#if FSM_TIMED_TRANSITIONS
+    slot->first_timed_transition = read_image(read_byte, entry + 3, 2);
+#endif
+#if FSM_INSTRUMENTATION
+    memset(&slot->metrics, 0, sizeof(slot->metrics));
+#endif
+  }
+  m_num_states = n;
+
+  for (int i = 0; i < c; ++i, ++entry)
+  {
+    m_callbacks[i].function = handlers[i];
+    m_callbacks[i].takes_context = (read_byte(entry) & 1) != 0;
+  }
+  m_num_callbacks = c;
+
+  m_num_transitions = t;
+#if FSM_TIMED_TRANSITIONS
+  m_num_timed_transitions = tt;
+#endif
+  for (int i = 0; i < n; ++i)
+  {
+    for (int j = m_states[i].first_transition;
+         j < FsmDefinition::transitions_end(i);
+         ++j, entry += FSM_IMAGE_TRANSITION_SIZE)
+    {
+      Transition transition = FsmDefinition::create_transition(
+          i, read_byte(entry + 2), (int16_t) read_image(read_byte, entry, 2),
+          read_byte(entry + 3));
+      transition.guard = read_byte(entry + 4);
+      m_transitions[j] = transition;
+    }
+  }
+
+#if FSM_TIMED_TRANSITIONS
+  for (int i = 0; i < n; ++i)
+  {
+    for (int j = m_states[i].first_timed_transition;
+         j < FsmDefinition::timed_transitions_end(i);
+         ++j, entry += FSM_IMAGE_TIMED_TRANSITION_SIZE)
+    {
+      TimedTransition* timed_transition = &m_timed_transitions[j];
+      timed_transition->transition = FsmDefinition::create_transition(
+          i, read_byte(entry + 4), 0, read_byte(entry + 5));
+      timed_transition->interval = read_image(read_byte, entry, 4);
+#if FSM_FINE_TIMERS
+      timed_transition->fine = (read_byte(entry + 6) & 1) != 0;
+#endif
+    }
+  }
+#endif
+
+  m_compiled = true;
+  FsmDefinition::compile_dense_table();
+  return true;
+}
@@ -0,0 +1,51 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "Fsm.h"
+
+
+#if FSM_INSTRUMENTATION
+const FsmDefinition::Metrics& FsmDefinition::metrics() const
+{
+  return m_metrics;
+}
+
+const FsmDefinition::StateMetrics* FsmDefinition::state_metrics(
+    State* state) const
+{
+  for (int i = 0; i < m_num_states; ++i)
+  {
+    if (m_states[i].state == state)
+      return &m_states[i].metrics;
+  }
+  return NULL;
+}
+
+void FsmInstance::measure(const State* state, void (*handler)(),
+                          unsigned long* worst_us)
+{
+  unsigned long start = micros();
+  FsmInstance::call_handler(state, handler);
+  unsigned long duration = micros() - start;
+  if (duration > *worst_us)
+    *worst_us = duration;
+}
+
+
+void Fsm::set_metrics_hook(MetricsHook hook)
+{
+  m_metrics_hook = hook;
+}
+#endif
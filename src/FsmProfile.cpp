@@ -0,0 +1,149 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "FsmProfile.h"
+
+
+#if FSM_PROFILING
+
+#define FSM_PROFILE_VERSION 1
+
+
+static void count(uint16_t* counter)
+{
+  if (*counter != 0xFFFF)
+    (*counter)++;
+}
+
+
+static void write_u16(Print& out, uint16_t value)
+{
+  uint8_t bytes[2] = {(uint8_t) value, (uint8_t) (value >> 8)};
+  out.write(bytes, sizeof(bytes));
+}
+
+
+FsmProfile::FsmProfile(Histogram* histograms, int num_transitions,
+                       Cell* cells, int num_states, int num_events)
+: m_histograms(histograms),
+  m_num_transitions(histograms != NULL ? num_transitions : 0),
+  m_cells(cells),
+  m_num_states(cells != NULL ? num_states : 0),
+  m_num_events(cells != NULL ? num_events : 0),
+  m_other_events(0)
+{
+  FsmProfile::clear();
+}
+
+
+void FsmProfile::clear()
+{
+  if (m_histograms != NULL)
+    memset(m_histograms, 0, m_num_transitions * sizeof(Histogram));
+  if (m_cells != NULL)
+    memset(m_cells, 0, m_num_states * m_num_events * sizeof(Cell));
+  m_other_events = 0;
+}
+
+
+const FsmProfile::Histogram* FsmProfile::histogram(int transition) const
+{
+  if (transition < 0 || transition >= m_num_transitions)
+    return NULL;
+  return &m_histograms[transition];
+}
+
+
+const FsmProfile::Cell* FsmProfile::cell(fsm_state_t state, int event) const
+{
+  if (state >= m_num_states || event < 0 || event >= m_num_events)
+    return NULL;
+  return &m_cells[state * m_num_events + event];
+}
+
+
+unsigned int FsmProfile::other_events() const
+{
+  return m_other_events;
+}
+
+
+void FsmProfile::record_event(fsm_state_t state, int event, bool matched)
+{
+  if (state >= m_num_states || event < 0 || event >= m_num_events)
+  {
+    m_other_events++;
+    return;
+  }
+
+  Cell* cell = &m_cells[state * m_num_events + event];
+  count(&cell->arrivals);
+  if (!matched)
+    count(&cell->unmatched);
+}
+
+
+void FsmProfile::record_latency(int transition, unsigned long us)
+{
+  if (transition < 0 || transition >= m_num_transitions)
+    return;
+
+  int bucket = 0;
+  for (us >>= 3; us > 0 && bucket < FSM_PROFILE_BUCKETS - 1; us >>= 1)
+    bucket++;
+  count(&m_histograms[transition].buckets[bucket]);
+}
+
+
+void FsmProfile::dump(Print& out, const FsmDefinition& definition) const
+{
+  int num_transitions = definition.m_num_transitions;
+  if (num_transitions > m_num_transitions)
+    num_transitions = m_num_transitions;
+  int num_states = definition.m_num_states;
+  if (num_states > m_num_states)
+    num_states = m_num_states;
+
+  // Little endian like FsmTrace::dump(). The transitions are described so
+  // the host tool can label the histograms without the sketch's source.
+  uint8_t header[8] = {'F', 'S', 'M', 'P', FSM_PROFILE_VERSION,
+                       FSM_PROFILE_BUCKETS, (uint8_t) num_states,
+                       (uint8_t) (definition.m_dense != NULL)};
+  out.write(header, sizeof(header));
+  write_u16(out, FSM_DENSE_TABLE_SIZE);
+  write_u16(out, m_num_events);
+  write_u16(out, num_transitions);
+  write_u16(out, m_other_events > 0xFFFF ? 0xFFFF : m_other_events);
+
+  for (int i = 0; i < num_transitions; ++i)
+  {
+    const FsmDefinition::Transition* transition =
+        &definition.m_transitions[i];
+    uint8_t bytes[2] = {transition->state_from, transition->state_to};
+    out.write(bytes, sizeof(bytes));
+    write_u16(out, (uint16_t) (int16_t) transition->event);
+    for (int j = 0; j < FSM_PROFILE_BUCKETS; ++j)
+      write_u16(out, m_histograms[i].buckets[j]);
+  }
+
+  for (int i = 0; i < num_states * m_num_events; ++i)
+  {
+    write_u16(out, m_cells[i].arrivals);
+    write_u16(out, m_cells[i].unmatched);
+  }
+}
+
+#endif
@@ -0,0 +1,93 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef FSM_PROFILE_H
+#define FSM_PROFILE_H
+
+
+#include "Fsm.h"
+
+
+#if FSM_PROFILING
+
+// Latency buckets per transition. Bucket 0 counts latencies below 8
+// microseconds and every further bucket doubles the bound; the last one
+// counts everything longer.
+#ifndef FSM_PROFILE_BUCKETS
+#define FSM_PROFILE_BUCKETS 10
+#endif
+
+
+// Profiles a machine's dispatch for tuning: how long each transition takes
+// from the event being dispatched until the target's on_enter() handlers
+// have run, and how often each (state, event) pair arrives and finds no
+// transition. Attach it with Fsm::set_profile() in a build with
+// FSM_PROFILING=1. dump() writes the counters in the binary format read by
+// extras/tools/fsm_profile.py, which reports hot and unmatched pairs and
+// whether the dense dispatch table pays off.
+//
+// Events held back while a handler runs are timed from when they are
+// dispatched, and trigger_many() bursts are counted but not timed. Only
+// events 0 to num_events - 1 and the first num_states states get a cell;
+// the others are counted together in other_events().
+class FsmProfile
+{
+public:
+  struct Histogram
+  {
+    uint16_t buckets[FSM_PROFILE_BUCKETS];
+  };
+  struct Cell
+  {
+    uint16_t arrivals;
+    uint16_t unmatched;
+  };
+
+  // Use caller provided storage: a histogram for each of the first
+  // num_transitions transitions, in the order of the compiled table, and
+  // num_states * num_events cells, one row of events per state. Counters
+  // stop at 0xFFFF.
+  FsmProfile(Histogram* histograms, int num_transitions, Cell* cells,
+             int num_states, int num_events);
+
+  void clear();
+
+  // NULL if there is no histogram or cell for the transition or pair.
+  const Histogram* histogram(int transition) const;
+  const Cell* cell(fsm_state_t state, int event) const;
+
+  unsigned int other_events() const;
+
+  // Write the "FSMP" header, the definition's transitions with their
+  // histograms and all cells.
+  void dump(Print& out, const FsmDefinition& definition) const;
+
+  void record_event(fsm_state_t state, int event, bool matched);
+  void record_latency(int transition, unsigned long us);
+
+private:
+  Histogram* m_histograms;
+  int m_num_transitions;
+  Cell* m_cells;
+  int m_num_states;
+  int m_num_events;
+  unsigned int m_other_events;
+};
+
+#endif
+
+
+#endif
@@ -0,0 +1,91 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "Fsm.h"
+#include "FsmScheduler.h"
+
+
+void Fsm::set_event_queue(volatile int* buffer, uint8_t size)
+{
+  m_queue = NULL;
+  m_queue_head = 0;
+  m_queue_tail = 0;
+
+  // A ring buffer keeps one slot free, so it needs two to hold anything.
+  if (buffer == NULL || size < 2)
+    return;
+  m_queue_size = size;
+  m_queue = buffer;
+  if (m_process_events == NULL)
+    m_process_events = &Fsm::process_events;
+}
+
+
+bool Fsm::post(int event)
+{
+  if (m_queue == NULL)
+    return false;
+
+  uint8_t head = m_queue_head;
+  uint8_t next = head + 1;
+  if (next == m_queue_size)
+    next = 0;
+  if (next == m_queue_tail)
+  {
+#if FSM_INSTRUMENTATION
+    m_metrics.dropped_events++;
+#endif
+    return false;
+  }
+
+  // Publish the event before moving the head past it.
+  m_queue[head] = event;
+  m_queue_head = next;
+
+  if (m_scheduler != NULL)
+    m_scheduler->mark_ready(this);
+  return true;
+}
+
+
+void Fsm::process_events()
+{
+  bool step = Fsm::begin_machine_step();
+  if (m_queue != NULL)
+  {
+    uint8_t head = m_queue_head;
+    uint8_t tail = m_queue_tail;
+    while (tail != head)
+    {
+      int event = m_queue[tail];
+      if (++tail == m_queue_size)
+        tail = 0;
+      m_queue_tail = tail;
+      Fsm::deliver(event);
+      Fsm::deliver_pending();
+    }
+  }
+
+  // The hardware timer's timeout, handled like a posted event. It may fire
+  // early for deadlines beyond its range, so arm it again either way.
+  if (m_timeout_due)
+  {
+    m_timeout_due = false;
+    Fsm::check_timed_transitions(FSM_CLOCK());
+    Fsm::arm_timer();
+  }
+  if (step)
+    Fsm::end_machine_step();
+}
@@ -0,0 +1,377 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "FsmScheduler.h"
+
+
+// The ready list is pushed to from interrupt handlers, the esp_timer task
+// and handlers on the main loop, so it is only changed with interrupts
+// disabled. The previous state is restored, as the push may itself run in
+// an interrupt handler.
+#if defined(__AVR__)
+
+typedef uint8_t FsmLock;
+
+static FsmLock lock()
+{
+  FsmLock sreg = SREG;
+  cli();
+  return sreg;
+}
+
+static void unlock(FsmLock sreg)
+{
+  SREG = sreg;
+}
+
+#elif defined(ARDUINO_ARCH_ESP32)
+
+typedef int FsmLock;
+
+static portMUX_TYPE s_ready_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static FsmLock lock()
+{
+  portENTER_CRITICAL_SAFE(&s_ready_lock);
+  return 0;
+}
+
+static void unlock(FsmLock)
+{
+  portEXIT_CRITICAL_SAFE(&s_ready_lock);
+}
+
+#else
+
+typedef int FsmLock;
+
+static FsmLock lock()
+{
+  noInterrupts();
+  return 0;
+}
+
+static void unlock(FsmLock)
+{
+  interrupts();
+}
+
+#endif
+
+FsmScheduler::FsmScheduler()
+: m_machines(NULL),
+  m_num_machines(0),
+  m_capacity(0),
+  m_num_timed(0),
+  m_num_polled(0),
+  m_epoch(0),
+  m_ready(NULL),
+  m_stale(NULL),
+  m_dirty(false),
+  m_owns_storage(true)
+{
+}
+
+
+FsmScheduler::FsmScheduler(Fsm** machines, int capacity)
+: m_machines(machines),
+  m_num_machines(0),
+  m_capacity(machines != NULL ? capacity : 0),
+  m_num_timed(0),
+  m_num_polled(0),
+  m_epoch(0),
+  m_ready(NULL),
+  m_stale(NULL),
+  m_dirty(false),
+  m_owns_storage(false)
+{
+}
+
+
+FsmScheduler::~FsmScheduler()
+{
+  for (int i = 0; i < m_num_machines; ++i)
+  {
+    m_machines[i]->m_scheduler = NULL;
+    m_machines[i]->m_stale = false;
+  }
+
+  if (m_owns_storage)
+    free(m_machines);
+  m_machines = NULL;
+}
+
+
+bool FsmScheduler::add(Fsm* fsm)
+{
+  if (fsm == NULL || fsm->m_scheduler != NULL)
+    return false;
+
+  if (m_num_machines == m_capacity)
+  {
+    if (!m_owns_storage)
+      return false;
+
+    int capacity = m_capacity + m_capacity / 2 + 1;
+    Fsm** machines = (Fsm**) realloc(m_machines, capacity * sizeof(Fsm*));
+    if (machines == NULL)
+      return false;
+    m_machines = machines;
+    m_capacity = capacity;
+  }
+
+  m_machines[m_num_machines] = fsm;
+  m_num_machines++;
+  fsm->m_scheduler = this;
+  m_dirty = true;
+  return true;
+}
+
+
+void FsmScheduler::run()
+{
+  unsigned long now = FSM_CLOCK();
+  FsmScheduler::refresh(now);
+
+  // Transitions taken below only put the machine on the stale list, so the
+  // machines stay where they are until the end of the tick.
+  for (int i = m_num_machines - m_num_polled; i < m_num_machines; ++i)
+    m_machines[i]->run_machine(now);
+
+  // Take the list of machines with posted events.
+  FsmLock state = lock();
+  Fsm* fsm = m_ready;
+  m_ready = NULL;
+  unlock(state);
+
+  // Polled machines have already run this tick, the others may also have
+  // been woken.
+  while (fsm != NULL)
+  {
+    Fsm* next = fsm->m_next_ready;
+    fsm->m_ready = false;
+    if (fsm->has_on_state())
+    {
+      if (fsm->m_process_events != NULL)
+        (fsm->*fsm->m_process_events)();
+    }
+    else
+      fsm->run_machine(now);
+    fsm = next;
+  }
+
+  // Run the machines whose deadline has passed and place them again once
+  // all of them have run.
+  while (m_num_timed > 0 &&
+         m_machines[0]->m_deadline - m_epoch <= now - m_epoch)
+  {
+    fsm = m_machines[0];
+    m_num_timed--;
+    FsmScheduler::swap(0, m_num_timed);
+    FsmScheduler::sift_down(0);
+
+    fsm->run_machine(now);
+    FsmScheduler::invalidate(fsm);
+  }
+
+  // Every deadline left is later than now.
+  m_epoch = now;
+  FsmScheduler::refresh(now);
+}
+
+
+unsigned long FsmScheduler::ms_until_next_timeout()
+{
+  unsigned long now = FSM_CLOCK();
+  FsmScheduler::refresh(now);
+
+  if (m_num_polled > 0 || m_ready != NULL)
+    return 0;
+  if (m_num_timed == 0)
+    return FSM_NO_TIMEOUT;
+
+  unsigned long elapsed = now - m_epoch;
+  unsigned long wait = m_machines[0]->m_deadline - m_epoch;
+  return elapsed >= wait ? 0 : wait - elapsed;
+}
+
+
+void FsmScheduler::invalidate(Fsm* fsm)
+{
+  if (fsm->m_stale)
+    return;
+
+  fsm->m_stale = true;
+  fsm->m_next_stale = m_stale;
+  m_stale = fsm;
+}
+
+
+void FsmScheduler::mark_ready(Fsm* fsm)
+{
+  FsmLock state = lock();
+  if (!fsm->m_ready)
+  {
+    fsm->m_ready = true;
+    fsm->m_next_ready = m_ready;
+    m_ready = fsm;
+  }
+  unlock(state);
+}
+
+
+void FsmScheduler::refresh(unsigned long now)
+{
+  if (m_dirty)
+    FsmScheduler::update(now);
+
+  while (m_stale != NULL)
+  {
+    Fsm* fsm = m_stale;
+    m_stale = fsm->m_next_stale;
+    fsm->m_stale = false;
+    FsmScheduler::place(fsm, now);
+  }
+}
+
+
+void FsmScheduler::update(unsigned long now)
+{
+  // Place every machine, after add(): the ones that have to be polled go to
+  // the end, the ones with a deadline to the front, which is then made a
+  // heap.
+  m_dirty = false;
+  m_epoch = now;
+  m_num_timed = 0;
+  m_num_polled = 0;
+
+  for (int i = 0; i < m_num_machines; ++i)
+    m_machines[i]->m_slot = i;
+
+  int i = 0;
+  while (i < m_num_machines - m_num_polled)
+  {
+    Fsm* fsm = m_machines[i];
+    if (fsm->has_on_state())
+    {
+      m_num_polled++;
+      FsmScheduler::swap(i, m_num_machines - m_num_polled);
+      continue;
+    }
+
+    unsigned long wait = fsm->ms_until_next_timeout(now);
+    if (wait != FSM_NO_TIMEOUT)
+    {
+      fsm->m_deadline = now + wait;
+      FsmScheduler::swap(i, m_num_timed);
+      m_num_timed++;
+    }
+    ++i;
+  }
+
+  for (i = m_num_timed / 2 - 1; i >= 0; --i)
+    FsmScheduler::sift_down(i);
+}
+
+
+void FsmScheduler::place(Fsm* fsm, unsigned long now)
+{
+  // Take the machine out of the heap or the polled machines, so that it
+  // sits with the machines that only run for events.
+  int slot = fsm->m_slot;
+  if (slot < m_num_timed)
+  {
+    m_num_timed--;
+    FsmScheduler::swap(slot, m_num_timed);
+    if (slot < m_num_timed)
+    {
+      FsmScheduler::sift_down(slot);
+      FsmScheduler::sift_up(slot);
+    }
+  }
+  else if (slot >= m_num_machines - m_num_polled)
+  {
+    FsmScheduler::swap(slot, m_num_machines - m_num_polled);
+    m_num_polled--;
+  }
+
+  if (fsm->has_on_state())
+  {
+    m_num_polled++;
+    FsmScheduler::swap(fsm->m_slot, m_num_machines - m_num_polled);
+    return;
+  }
+
+  unsigned long wait = fsm->ms_until_next_timeout(now);
+  if (wait == FSM_NO_TIMEOUT)
+    return;
+
+  // Keep the deadline within reach of m_epoch; a machine run early just
+  // gets its deadline again.
+  unsigned long elapsed = now - m_epoch;
+  if (wait > FSM_NO_TIMEOUT - 1 - elapsed)
+    wait = FSM_NO_TIMEOUT - 1 - elapsed;
+  fsm->m_deadline = now + wait;
+  FsmScheduler::swap(fsm->m_slot, m_num_timed);
+  m_num_timed++;
+  FsmScheduler::sift_up(m_num_timed - 1);
+}
+
+
+void FsmScheduler::swap(int a, int b)
+{
+  Fsm* fsm = m_machines[a];
+  m_machines[a] = m_machines[b];
+  m_machines[b] = fsm;
+  m_machines[a]->m_slot = a;
+  m_machines[b]->m_slot = b;
+}
+
+
+bool FsmScheduler::before(int a, int b) const
+{
+  return m_machines[a]->m_deadline - m_epoch <
+         m_machines[b]->m_deadline - m_epoch;
+}
+
+
+void FsmScheduler::sift_up(int slot)
+{
+  while (slot > 0)
+  {
+    int parent = (slot - 1) / 2;
+    if (!FsmScheduler::before(slot, parent))
+      return;
+    FsmScheduler::swap(slot, parent);
+    slot = parent;
+  }
+}
+
+
+void FsmScheduler::sift_down(int slot)
+{
+  for (;;)
+  {
+    int child = 2 * slot + 1;
+    if (child >= m_num_timed)
+      return;
+    if (child + 1 < m_num_timed && FsmScheduler::before(child + 1, child))
+      child++;
+    if (!FsmScheduler::before(child, slot))
+      return;
+    FsmScheduler::swap(slot, child);
+    slot = child;
+  }
+}
@@ -0,0 +1,87 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef FSM_SCHEDULER_H
+#define FSM_SCHEDULER_H
+
+
+#include "Fsm.h"
+
+
+// Runs many machines from one loop. The clock is read once per run() and a
+// machine is only touched when it has something to do: its state has an
+// on_state() handler, an event was posted to it or its timed transition is
+// due. Machines that do nothing cost nothing per tick: the others are kept
+// in a heap by deadline, and a transition only moves the machine that took
+// it.
+class FsmScheduler
+{
+public:
+  FsmScheduler();
+
+  // Use caller provided storage for the machine list instead of the heap.
+  FsmScheduler(Fsm** machines, int capacity);
+  ~FsmScheduler();
+
+  // Returns false if there is no room for the machine or it already belongs
+  // to a scheduler.
+  bool add(Fsm* fsm);
+
+  void run();
+
+  // Milliseconds until run() has work to do, 0 if some machine has to be
+  // polled or FSM_NO_TIMEOUT if all of them are idle.
+  unsigned long ms_until_next_timeout();
+
+private:
+  friend class ConcurrentFsm;
+  friend class Fsm;
+
+  // Virtual so that Fsm reaches them without linking this file into
+  // sketches that never create an FsmScheduler.
+  virtual void invalidate(Fsm* fsm);
+  virtual void mark_ready(Fsm* fsm);
+  void refresh(unsigned long now);
+  void update(unsigned long now);
+  void place(Fsm* fsm, unsigned long now);
+  void swap(int a, int b);
+  bool before(int a, int b) const;
+  void sift_up(int slot);
+  void sift_down(int slot);
+
+private:
+  // Machines [0, m_num_timed) are a heap by deadline, the last m_num_polled
+  // are run on every tick and those in between only when they have events.
+  Fsm** m_machines;
+  int m_num_machines;
+  int m_capacity;
+  int m_num_timed;
+  int m_num_polled;
+
+  // Deadlines are compared as the time since m_epoch, which no deadline in
+  // the heap is earlier than.
+  unsigned long m_epoch;
+
+  Fsm* volatile m_ready;
+
+  // Machines that took a transition since the last run() and have to be
+  // placed again.
+  Fsm* m_stale;
+  bool m_dirty;
+  bool m_owns_storage;
+};
+
+
+#endif
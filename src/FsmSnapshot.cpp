@@ -0,0 +1,110 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "Fsm.h"
+#include "FsmScheduler.h"
+
+
+void FsmInstance::snapshot(uint8_t* buffer) const
+{
+  // Flags, state and the timer's elapsed time, little endian.
+#if FSM_TIMED_TRANSITIONS
+  unsigned long elapsed = m_timer_armed ? FSM_CLOCK() - m_timer_start : 0;
+  buffer[0] = (m_initialized ? 1 : 0) | (m_timer_armed ? 2 : 0);
+#else
+  unsigned long elapsed = 0;
+  buffer[0] = m_initialized ? 1 : 0;
+#endif
+  buffer[1] = m_current_state;
+  for (int i = 0; i < 4; ++i)
+    buffer[2 + i] = (uint8_t) (elapsed >> (8 * i));
+}
+
+bool FsmInstance::can_restore(const uint8_t* buffer) const
+{
+  return m_definition != NULL && (buffer[0] & ~3) == 0 &&
+         buffer[1] < m_definition->m_num_states;
+}
+
+bool FsmInstance::restore(const uint8_t* buffer)
+{
+  if (!FsmInstance::can_restore(buffer))
+    return false;
+
+#if FSM_TIMED_TRANSITIONS || FSM_ON_STATE
+  unsigned long now = FSM_CLOCK();
+#endif
+  m_initialized = (buffer[0] & 1) != 0;
+  m_current_state = buffer[1];
+#if FSM_TIMED_TRANSITIONS
+  uint32_t elapsed = 0;
+  for (int i = 0; i < 4; ++i)
+    elapsed |= (uint32_t) buffer[2 + i] << (8 * i);
+  m_timer_armed = (buffer[0] & 2) != 0;
+  m_timer_start = now - elapsed;
+#endif
+#if FSM_FINE_TIMERS
+  // Fine timers are too short to survive a reset; they start over.
+  m_fine_timer_start = FSM_FINE_CLOCK();
+#endif
+#if FSM_ON_STATE
+  m_last_poll = now;
+  m_woken = m_initialized;
+#endif
+#if FSM_DEFERRED_EVENTS > 0
+  m_num_deferred = 0;
+  m_busy = false;
+#endif
+#if FSM_INSTRUMENTATION
+  m_entered = millis();
+#endif
+  FsmInstance::select_timer();
+  return true;
+}
+
+
+size_t Fsm::snapshot_size() const
+{
+  return 1 + (size_t) (1 + m_num_regions) * FSM_SNAPSHOT_SIZE;
+}
+
+size_t Fsm::snapshot(uint8_t* buffer) const
+{
+  buffer[0] = 1 + m_num_regions;
+  FsmInstance::snapshot(buffer + 1);
+  for (int i = 0; i < m_num_regions; ++i)
+    m_regions[i].snapshot(buffer + 1 + (i + 1) * FSM_SNAPSHOT_SIZE);
+  return Fsm::snapshot_size();
+}
+
+bool Fsm::restore(const uint8_t* buffer)
+{
+  // Check every region first, so a bad snapshot changes nothing.
+  if (buffer[0] != 1 + m_num_regions ||
+      !FsmInstance::can_restore(buffer + 1))
+    return false;
+  for (int i = 0; i < m_num_regions; ++i)
+    if (!m_regions[i].can_restore(buffer + 1 + (i + 1) * FSM_SNAPSHOT_SIZE))
+      return false;
+
+  FsmInstance::restore(buffer + 1);
+  for (int i = 0; i < m_num_regions; ++i)
+    m_regions[i].restore(buffer + 1 + (i + 1) * FSM_SNAPSHOT_SIZE);
+
+  if (m_scheduler != NULL)
+    m_scheduler->invalidate(this);
+  Fsm::arm_timer();
+  return true;
+}
@@ -0,0 +1,510 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "Fsm.h"
+#include "FsmScheduler.h"
+#include "FsmTimer.h"
+
+
+#if FSM_TIMED_TRANSITIONS
+bool FsmDefinition::reserve_timed_transitions(int capacity)
+{
+  if (capacity <= m_timed_transitions_capacity)
+    return true;
+  if (!m_owns_storage)
+    return false;
+
+  TimedTransition* timed_transitions = (TimedTransition*) realloc(
+      m_timed_transitions, capacity * sizeof(TimedTransition));
+  if (timed_transitions == NULL)
+    return false;
+  m_timed_transitions = timed_transitions;
+  m_timed_transitions_capacity = capacity;
+  return true;
+}
+#endif
+
+
+#if FSM_TIMED_TRANSITIONS
+bool FsmDefinition::add_timed_transition(State* state_from, State* state_to,
+                                         unsigned long interval,
+                                         void (*on_transition)())
+{
+  return FsmDefinition::add_timed_transition(state_from, state_to, interval,
+                                             on_transition, false);
+}
+
+
+bool FsmDefinition::add_timed_transition(State* state_from, State* state_to,
+                                         unsigned long interval,
+                                         FsmContextHandler on_transition)
+{
+  return FsmDefinition::add_timed_transition(
+      state_from, state_to, interval, (void (*)()) on_transition.function,
+      true);
+}
+
+
+#if FSM_FINE_TIMERS
+bool FsmDefinition::add_fine_timed_transition(State* state_from,
+                                              State* state_to,
+                                              unsigned long interval,
+                                              void (*on_transition)())
+{
+  return FsmDefinition::add_timed_transition(state_from, state_to, interval,
+                                             on_transition, false, true);
+}
+
+
+bool FsmDefinition::add_fine_timed_transition(State* state_from,
+                                              State* state_to,
+                                              unsigned long interval,
+                                              FsmContextHandler on_transition)
+{
+  return FsmDefinition::add_timed_transition(
+      state_from, state_to, interval, (void (*)()) on_transition.function,
+      true, true);
+}
+#endif
+
+
+bool FsmDefinition::add_timed_transition(State* state_from, State* state_to,
+                                         unsigned long interval,
+                                         void (*on_transition)(),
+                                         bool takes_context, bool fine)
+{
+  fsm_state_t from = FsmDefinition::register_state(state_from);
+  fsm_state_t to = FsmDefinition::register_state(state_to);
+  fsm_callback_t callback;
+  if (from == FSM_NO_STATE || to == FSM_NO_STATE ||
+      !FsmDefinition::register_callback(on_transition, takes_context,
+                                        &callback))
+    return false;
+
+  if (m_num_timed_transitions == m_timed_transitions_capacity &&
+      !FsmDefinition::reserve_timed_transitions(m_num_timed_transitions
+                                                + m_num_timed_transitions / 2
+                                                + 1))
+    return false;
+
+  Transition transition = FsmDefinition::create_transition(from, to, 0,
+                                                           callback);
+
+  TimedTransition timed_transition;
+  timed_transition.transition = transition;
+  timed_transition.interval = interval;
+#if FSM_FINE_TIMERS
+  timed_transition.fine = fine;
+#else
+  (void) fine;
+#endif
+
+  m_timed_transitions[m_num_timed_transitions] = timed_transition;
+  m_num_timed_transitions++;
+  m_compiled = false;
+  return true;
+}
+#endif
+
+#if FSM_TIMED_TRANSITIONS
+int FsmDefinition::timed_transitions_end(fsm_state_t state) const
+{
+  if (state + 1 < m_num_states)
+    return m_states[state + 1].first_timed_transition;
+  return m_num_timed_transitions;
+}
+
+int FsmDefinition::first_timer(fsm_state_t state, bool fine) const
+{
+  // Timed transitions of a state all start on entry, so the earliest
+  // deadline on each clock belongs to the one with the shortest interval.
+#if !FSM_FINE_TIMERS
+  if (fine)
+    return -1;
+#endif
+  int begin = 0;
+  int end = m_num_timed_transitions;
+  if (m_compiled)
+  {
+    begin = m_states[state].first_timed_transition;
+    end = FsmDefinition::timed_transitions_end(state);
+  }
+
+  int timer = -1;
+  for (int i = begin; i < end; ++i)
+  {
+    const TimedTransition* transition = &m_timed_transitions[i];
+    if (transition->transition.state_from == state &&
+#if FSM_FINE_TIMERS
+        transition->fine == fine &&
+#endif
+        (timer < 0 ||
+         transition->interval < m_timed_transitions[timer].interval))
+      timer = i;
+  }
+  return timer;
+}
+#endif
+
+void FsmInstance::check_timed_transitions()
+{
+  FsmInstance::check_timed_transitions(FSM_CLOCK());
+}
+
+void FsmInstance::check_timed_transitions(unsigned long now)
+{
+#if FSM_TIMED_TRANSITIONS
+  // Only the earliest deadline on each clock needs to be checked.
+#if FSM_FINE_TIMERS
+  if (m_timer < 0 && m_fine_timer < 0)
+    return;
+#else
+  if (m_timer < 0)
+    return;
+#endif
+
+  if (!m_timer_armed)
+  {
+    m_timer_start = now;
+    m_timer_armed = true;
+#if FSM_FINE_TIMERS
+    m_fine_timer_start = FSM_FINE_CLOCK();
+#endif
+    return;
+  }
+
+  const TimedTransition* timer = NULL;
+#if FSM_FINE_TIMERS
+  if (m_fine_timer >= 0)
+  {
+    const TimedTransition* fine_timer =
+        &m_definition->m_timed_transitions[m_fine_timer];
+    if (FSM_FINE_CLOCK() - m_fine_timer_start >= fine_timer->interval)
+      timer = fine_timer;
+  }
+#endif
+  if (timer == NULL && m_timer >= 0)
+  {
+    const TimedTransition* coarse_timer =
+        &m_definition->m_timed_transitions[m_timer];
+    if (now - m_timer_start >= coarse_timer->interval)
+      timer = coarse_timer;
+  }
+
+  if (timer != NULL && FsmInstance::begin_step())
+  {
+    FsmInstance::make_transition(&timer->transition);
+    FsmInstance::end_step();
+  }
+#else
+  (void) now;
+#endif
+}
+
+unsigned long FsmInstance::ms_until_next_timeout()
+{
+  return FsmInstance::ms_until_next_timeout(FSM_CLOCK());
+}
+
+unsigned long FsmInstance::ms_until_next_timeout(unsigned long now)
+{
+  unsigned long wait = FsmInstance::ms_until_next_poll(now);
+#if FSM_FINE_TIMERS
+  if (m_timer < 0 && m_fine_timer < 0)
+    return wait;
+#elif FSM_TIMED_TRANSITIONS
+  if (m_timer < 0)
+    return wait;
+#else
+  return wait;
+#endif
+
+#if FSM_TIMED_TRANSITIONS
+  // Not armed yet: the next check starts the interval.
+  if (!m_timer_armed)
+    return 0;
+
+  if (m_timer >= 0)
+  {
+    unsigned long elapsed = now - m_timer_start;
+    unsigned long interval =
+        m_definition->m_timed_transitions[m_timer].interval;
+    unsigned long left = elapsed >= interval ? 0 : interval - elapsed;
+    if (left < wait)
+      wait = left;
+  }
+#endif
+
+#if FSM_FINE_TIMERS
+  if (m_fine_timer >= 0)
+  {
+    // Round down, so the caller is back in time to check it.
+    unsigned long elapsed = FSM_FINE_CLOCK() - m_fine_timer_start;
+    unsigned long interval =
+        m_definition->m_timed_transitions[m_fine_timer].interval;
+    unsigned long left = elapsed >= interval ? 0 : interval - elapsed;
+#if FSM_FINE_CLOCK_HZ >= FSM_CLOCK_HZ
+    left /= FSM_FINE_CLOCK_HZ / FSM_CLOCK_HZ;
+#else
+    left *= FSM_CLOCK_HZ / FSM_FINE_CLOCK_HZ;
+#endif
+    if (left < wait)
+      wait = left;
+  }
+#endif
+  return wait;
+}
+
+unsigned long FsmInstance::ms_until_next_poll(unsigned long now) const
+{
+#if FSM_ON_STATE
+  // States polled on every call are not waited for.
+  if (!m_initialized)
+    return FSM_NO_TIMEOUT;
+  const State* state = m_definition->m_states[m_current_state].state;
+  if (state->on_state == NULL || state->poll_interval == 0)
+    return FSM_NO_TIMEOUT;
+
+  if (m_woken)
+    return 0;
+  if (state->poll_interval == FSM_POLL_ON_WAKE)
+    return FSM_NO_TIMEOUT;
+
+  unsigned long elapsed = now - m_last_poll;
+  return elapsed >= state->poll_interval ? 0
+                                         : state->poll_interval - elapsed;
+#else
+  (void) now;
+  return FSM_NO_TIMEOUT;
+#endif
+}
+
+unsigned long FsmInstance::us_until_next_timer(unsigned long now) const
+{
+  unsigned long wait = FSM_NO_TIMEOUT;
+#if FSM_TIMED_TRANSITIONS
+  if (m_timer >= 0)
+  {
+    if (!m_timer_armed)
+      return 0;
+    unsigned long elapsed = now - m_timer_start;
+    unsigned long interval =
+        m_definition->m_timed_transitions[m_timer].interval;
+    unsigned long left = elapsed >= interval ? 0 : interval - elapsed;
+#if FSM_CLOCK_HZ < 1000000
+    const unsigned long scale = 1000000UL / FSM_CLOCK_HZ;
+    left = left >= (FSM_NO_TIMEOUT - 1) / scale ? FSM_NO_TIMEOUT - 1
+                                                : left * scale;
+#endif
+    wait = left;
+  }
+#else
+  (void) now;
+#endif
+
+#if FSM_FINE_TIMERS
+  if (m_fine_timer >= 0)
+  {
+    if (!m_timer_armed)
+      return 0;
+    unsigned long elapsed = FSM_FINE_CLOCK() - m_fine_timer_start;
+    unsigned long interval =
+        m_definition->m_timed_transitions[m_fine_timer].interval;
+    unsigned long left = elapsed >= interval ? 0 : interval - elapsed;
+#if FSM_FINE_CLOCK_HZ < 1000000
+    const unsigned long scale = 1000000UL / FSM_FINE_CLOCK_HZ;
+    left = left >= (FSM_NO_TIMEOUT - 1) / scale ? FSM_NO_TIMEOUT - 1
+                                                : left * scale;
+#endif
+    if (left < wait)
+      wait = left;
+  }
+#endif
+  return wait;
+}
+
+bool FsmInstance::next_deadline(unsigned long* deadline)
+{
+  unsigned long now = FSM_CLOCK();
+  unsigned long wait = FsmInstance::ms_until_next_timeout(now);
+  if (wait == FSM_NO_TIMEOUT)
+    return false;
+
+  *deadline = now + wait;
+  return true;
+}
+
+void FsmInstance::select_timer()
+{
+#if FSM_TIMED_TRANSITIONS
+  m_timer = -1;
+#if FSM_FINE_TIMERS
+  m_fine_timer = -1;
+#endif
+  if (m_definition == NULL || m_definition->m_num_states == 0)
+    return;
+
+  m_timer = m_definition->first_timer(m_current_state, false);
+#if FSM_FINE_TIMERS
+  m_fine_timer = m_definition->first_timer(m_current_state, true);
+#endif
+#endif
+}
+
+
+#if FSM_TIMED_TRANSITIONS
+bool Fsm::add_timed_transition(State* state_from, State* state_to,
+                               unsigned long interval, void (*on_transition)())
+{
+  bool added = FsmDefinition::add_timed_transition(state_from, state_to,
+                                                   interval, on_transition);
+  Fsm::select_timers();
+  return added;
+}
+
+
+bool Fsm::add_timed_transition(State* state_from, State* state_to,
+                               unsigned long interval,
+                               FsmContextHandler on_transition)
+{
+  bool added = FsmDefinition::add_timed_transition(state_from, state_to,
+                                                   interval, on_transition);
+  Fsm::select_timers();
+  return added;
+}
+#endif
+
+
+#if FSM_FINE_TIMERS
+bool Fsm::add_fine_timed_transition(State* state_from, State* state_to,
+                                    unsigned long interval,
+                                    void (*on_transition)())
+{
+  bool added = FsmDefinition::add_fine_timed_transition(
+      state_from, state_to, interval, on_transition);
+  Fsm::select_timers();
+  return added;
+}
+
+
+bool Fsm::add_fine_timed_transition(State* state_from, State* state_to,
+                                    unsigned long interval,
+                                    FsmContextHandler on_transition)
+{
+  bool added = FsmDefinition::add_fine_timed_transition(
+      state_from, state_to, interval, on_transition);
+  Fsm::select_timers();
+  return added;
+}
+#endif
+
+
+void Fsm::select_timers()
+{
+  FsmInstance::select_timer();
+  for (int i = 0; i < m_num_regions; ++i)
+    m_regions[i].select_timer();
+  Fsm::arm_timer();
+}
+
+
+void Fsm::arm_timer()
+{
+  if (m_hardware_timer != NULL)
+    m_hardware_timer->arm(Fsm::us_until_next_timer());
+}
+
+
+void Fsm::timer_fired()
+{
+  m_timeout_due = true;
+  if (m_scheduler != NULL)
+    m_scheduler->mark_ready(this);
+}
+
+
+unsigned long Fsm::us_until_next_timer() const
+{
+  unsigned long now = FSM_CLOCK();
+  unsigned long wait = FsmInstance::us_until_next_timer(now);
+  for (int i = 0; i < m_num_regions; ++i)
+  {
+    unsigned long region_wait = m_regions[i].us_until_next_timer(now);
+    if (region_wait < wait)
+      wait = region_wait;
+  }
+  return wait;
+}
+
+
+void Fsm::check_timed_transitions()
+{
+  Fsm::check_timed_transitions(FSM_CLOCK());
+}
+
+
+void Fsm::check_timed_transitions(unsigned long now)
+{
+  bool step = Fsm::begin_machine_step();
+  FsmInstance::check_timed_transitions(now);
+  for (int i = 0; i < m_num_regions; ++i)
+    m_regions[i].check_timed_transitions(now);
+  if (step)
+    Fsm::end_machine_step();
+}
+
+
+unsigned long Fsm::ms_until_next_timeout()
+{
+  return Fsm::ms_until_next_timeout(FSM_CLOCK());
+}
+
+
+unsigned long Fsm::ms_until_next_timeout(unsigned long now)
+{
+  unsigned long wait = FsmInstance::ms_until_next_timeout(now);
+  for (int i = 0; i < m_num_regions; ++i)
+  {
+    unsigned long region_wait = m_regions[i].ms_until_next_timeout(now);
+    if (region_wait < wait)
+      wait = region_wait;
+  }
+  return wait;
+}
+
+
+bool Fsm::next_deadline(unsigned long* deadline)
+{
+  unsigned long wait = Fsm::ms_until_next_timeout();
+  if (wait == FSM_NO_TIMEOUT)
+    return false;
+
+  *deadline = FSM_CLOCK() + wait;
+  return true;
+}
+
+
+unsigned long Fsm::ms_until_next_timeout(Fsm* const* machines, int count)
+{
+  unsigned long now = FSM_CLOCK();
+  unsigned long wait = FSM_NO_TIMEOUT;
+  for (int i = 0; i < count; ++i)
+  {
+    unsigned long machine_wait = machines[i]->ms_until_next_timeout(now);
+    if (machine_wait < wait)
+      wait = machine_wait;
+  }
+  return wait;
+}
@@ -0,0 +1,179 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "FsmTimer.h"
+
+#if defined(ARDUINO_ARCH_ESP32)
+  #include <esp_timer.h>
+#endif
+
+
+FsmTimer* volatile FsmTimer::s_running = NULL;
+
+
+#if defined(__AVR__) && defined(TIMSK1)
+
+// Timer1 in CTC mode at clk/64, one compare match per arm().
+#define FSM_TIMER_PRESCALER 64
+#define FSM_TIMER_MAX_US (0xFFFFUL * FSM_TIMER_PRESCALER \
+                          / (F_CPU / 1000000UL))
+
+static bool timer_begin()
+{
+  TIMSK1 &= ~_BV(OCIE1A);
+  TCCR1A = 0;
+  TCCR1B = 0;
+  return true;
+}
+
+static void timer_stop()
+{
+  TIMSK1 &= ~_BV(OCIE1A);
+  TCCR1B = 0;
+}
+
+static void timer_start(unsigned long us)
+{
+  if (us > FSM_TIMER_MAX_US)
+    us = FSM_TIMER_MAX_US;
+  unsigned long ticks = us * (F_CPU / 1000000UL) / FSM_TIMER_PRESCALER;
+  if (ticks == 0)
+    ticks = 1;
+
+  uint8_t sreg = SREG;
+  cli();
+  TCCR1B = 0;
+  TCNT1 = 0;
+  OCR1A = ticks;
+  TIFR1 = _BV(OCF1A);
+  TIMSK1 |= _BV(OCIE1A);
+  TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10);
+  SREG = sreg;
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+  timer_stop();
+  FsmTimer::fire();
+}
+
+#elif defined(ARDUINO_ARCH_ESP32)
+
+static esp_timer_handle_t s_handle = NULL;
+
+static void on_timer(void*)
+{
+  FsmTimer::fire();
+}
+
+static bool timer_begin()
+{
+  if (s_handle != NULL)
+    return true;
+
+  esp_timer_create_args_t args = {};
+  args.callback = &on_timer;
+  args.name = "fsm";
+  return esp_timer_create(&args, &s_handle) == ESP_OK;
+}
+
+static void timer_stop()
+{
+  esp_timer_stop(s_handle);
+}
+
+static void timer_start(unsigned long us)
+{
+  esp_timer_stop(s_handle);
+  esp_timer_start_once(s_handle, us > 0 ? us : 1);
+}
+
+#else
+
+// No backend for this board: begin() fails.
+static bool timer_begin()
+{
+  return false;
+}
+
+static void timer_stop()
+{
+}
+
+static void timer_start(unsigned long)
+{
+}
+
+#endif
+
+
+FsmTimer::FsmTimer()
+: m_fsm(NULL)
+{
+}
+
+
+FsmTimer::~FsmTimer()
+{
+  FsmTimer::end();
+}
+
+
+bool FsmTimer::begin(Fsm* fsm)
+{
+  if (s_running != NULL || fsm->m_hardware_timer != NULL || !timer_begin())
+    return false;
+
+  m_fsm = fsm;
+  s_running = this;
+  fsm->m_timeout_due = false;
+  if (fsm->m_process_events == NULL)
+    fsm->m_process_events = &Fsm::process_events;
+  fsm->m_hardware_timer = this;
+  fsm->arm_timer();
+  return true;
+}
+
+
+void FsmTimer::end()
+{
+  if (s_running != this)
+    return;
+
+  timer_stop();
+  s_running = NULL;
+  m_fsm->m_hardware_timer = NULL;
+  m_fsm = NULL;
+}
+
+
+void FsmTimer::fire()
+{
+  FsmTimer* timer = s_running;
+  if (timer == NULL)
+    return;
+
+  timer->m_fsm->timer_fired();
+}
+
+
+void FsmTimer::arm(unsigned long us)
+{
+  if (us == FSM_NO_TIMEOUT)
+    timer_stop();
+  else
+    timer_start(us);
+}
@@ -0,0 +1,73 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef FSM_TIMER_H
+#define FSM_TIMER_H
+
+
+#include "Fsm.h"
+
+
+// Delivers a machine's timeouts from a hardware timer instead of checking
+// them on every run_machine() call: Timer1 output compare A on AVR (so not
+// together with the Servo library), or an esp_timer on ESP32. The timer is
+// programmed for the earliest deadline of the machine's timed transitions,
+// including fine ones, and is set again after every transition. When it
+// fires the machine is marked like a posted event, and the next
+// run_machine() or process_events() call takes the timed transition;
+// machines in an FsmScheduler are run on its next tick. Handlers never run
+// from the interrupt, so how late a transition runs still depends on how
+// often the sketch calls run_machine(); the timer only saves the checks in
+// between.
+//
+// On AVR at 16 MHz the timer counts in 4 us steps and reaches 262 ms, so
+// longer deadlines take several interrupts.
+//
+//   FsmTimer timer;
+//   timer.begin(&fsm);
+class FsmTimer
+{
+public:
+  FsmTimer();
+  ~FsmTimer();
+
+  // Take over the hardware timer for the machine. Returns false if this
+  // board has no timer backend or another FsmTimer is running.
+  bool begin(Fsm* fsm);
+
+  // Give the timer back; the machine checks its timers itself again.
+  //
+  // end() and arm() are virtual so that Fsm reaches them without linking
+  // this file, and with it the timer interrupt handler, into sketches that
+  // never create an FsmTimer.
+  virtual void end();
+
+  // Called from the timer interrupt.
+  static void fire();
+
+private:
+  friend class Fsm;
+
+  // Fire in us microseconds, or never for FSM_NO_TIMEOUT.
+  virtual void arm(unsigned long us);
+
+private:
+  Fsm* m_fsm;
+
+  static FsmTimer* volatile s_running;
+};
+
+
+#endif
@@ -0,0 +1,114 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "FsmTrace.h"
+
+
+#define FSM_TRACE_VERSION 1
+#define FSM_TRACE_RECORD_SIZE 8
+
+
+FsmTrace::FsmTrace(Record* records, int capacity)
+: m_records(records),
+  m_capacity(records != NULL ? capacity : 0),
+  m_head(0),
+  m_count(0),
+  m_last(FSM_CLOCK())
+{
+}
+
+
+void FsmTrace::clear()
+{
+  m_head = 0;
+  m_count = 0;
+  m_last = FSM_CLOCK();
+}
+
+
+int FsmTrace::count() const
+{
+  return m_count;
+}
+
+
+bool FsmTrace::read(int i, Record* record) const
+{
+  if (i < 0 || i >= m_count)
+    return false;
+
+  // m_head is the oldest record once the buffer has wrapped.
+  int index = m_head + i;
+  if (index >= m_capacity)
+    index -= m_capacity;
+  *record = m_records[index];
+  return true;
+}
+
+
+void FsmTrace::record(uint8_t machine, fsm_state_t state_from,
+                      fsm_state_t state_to, uint8_t kind, int event)
+{
+  if (m_capacity == 0)
+    return;
+
+  unsigned long now = FSM_CLOCK();
+  unsigned long delta = now - m_last;
+  m_last = now;
+
+  int index = m_head + m_count;
+  if (index >= m_capacity)
+    index -= m_capacity;
+  if (m_count == m_capacity)
+  {
+    if (++m_head == m_capacity)
+      m_head = 0;
+  }
+  else
+  {
+    m_count++;
+  }
+
+  Record* record = &m_records[index];
+  record->delta = delta > 0xFFFF ? 0xFFFF : delta;
+  record->machine = machine;
+  record->state_from = state_from;
+  record->state_to = state_to;
+  record->kind = kind;
+  record->event = event;
+}
+
+
+void FsmTrace::dump(Print& out) const
+{
+  // Fields are written little endian whatever the target, so the host tool
+  // only has to know one layout.
+  uint8_t header[8] = {'F', 'S', 'M', 'T', FSM_TRACE_VERSION,
+                       FSM_TRACE_RECORD_SIZE, (uint8_t) m_count,
+                       (uint8_t) (m_count >> 8)};
+  out.write(header, sizeof(header));
+
+  for (int i = 0; i < m_count; ++i)
+  {
+    Record record;
+    FsmTrace::read(i, &record);
+    uint8_t bytes[FSM_TRACE_RECORD_SIZE] = {(uint8_t) record.delta,
+        (uint8_t) (record.delta >> 8), record.machine, record.state_from,
+        record.state_to, record.kind, (uint8_t) record.event,
+        (uint8_t) ((uint16_t) record.event >> 8)};
+    out.write(bytes, sizeof(bytes));
+  }
+}
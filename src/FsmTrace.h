@@ -0,0 +1,75 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef FSM_TRACE_H
+#define FSM_TRACE_H
+
+
+#include "Fsm.h"
+
+
+#define FSM_TRACE_EVENT 0
+#define FSM_TRACE_TIMEOUT 1
+
+
+// Records transitions into a ring buffer in RAM, a few bytes each, so the
+// history leading up to a failure can be read back later without printing
+// from the handlers. Attach it with Fsm::set_trace(); several machines may
+// share one trace. dump() writes the records in the binary format read by
+// extras/tools/fsm_trace.py.
+class FsmTrace
+{
+public:
+  struct Record
+  {
+    // Clock ticks (see FSM_CLOCK) since the previous record, at most 0xFFFF.
+    uint16_t delta;
+    uint8_t machine;
+    uint8_t state_from;
+    uint8_t state_to;
+    uint8_t kind;
+    int16_t event;
+  };
+
+  // Use caller provided storage for the records. Once it is full the oldest
+  // record is overwritten.
+  FsmTrace(Record* records, int capacity);
+
+  void clear();
+
+  int count() const;
+
+  // Copy record i, oldest first. Returns false if there is no such record.
+  bool read(int i, Record* record) const;
+
+  // Write the "FSMT" header and all records, oldest first.
+  void dump(Print& out) const;
+
+  // Virtual so that Fsm reaches it without linking this file into
+  // sketches that never create an FsmTrace.
+  virtual void record(uint8_t machine, fsm_state_t state_from,
+                      fsm_state_t state_to, uint8_t kind, int event);
+
+private:
+  Record* m_records;
+  int m_capacity;
+  int m_head;
+  int m_count;
+  unsigned long m_last;
+};
+
+
+#endif
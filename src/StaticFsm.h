@@ -0,0 +1,317 @@
+// This file is part of arduino-fsm.
+//
+// arduino-fsm is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// arduino-fsm is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with arduino-fsm.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef STATIC_FSM_H
+#define STATIC_FSM_H
+
+
+#if defined(ARDUINO) && ARDUINO >= 100
+  #include <Arduino.h>
+#else
+  #include <WProgram.h>
+#endif
+
+
+// A state machine whose states and transitions are fixed at compile time.
+//
+// States are numbered by their position in StaticStates<> and transitions
+// are listed in a TransitionTable<>. The whole table is expanded into
+// constant comparisons and direct calls, so it lives in flash as code and
+// the machine only keeps its current state and timer start in RAM. An event
+// first finds the current state with a binary search over the state
+// numbers and then only compares the events of that state's transitions.
+//
+//   typedef StaticStates<StaticState<&on_off_enter>,
+//                        StaticState<&on_on_enter> > States;
+//   typedef TransitionTable<StaticTransition<0, 1, FLIP>,
+//                           StaticTransition<1, 0, FLIP>,
+//                           StaticTimedTransition<1, 0, 3000> > Transitions;
+//   StaticFsm<States, Transitions> fsm;
+
+
+template <void (*F)()>
+struct StaticCall
+{
+  static void run() { F(); }
+};
+
+template <>
+struct StaticCall<nullptr>
+{
+  static void run() {}
+};
+
+
+template <void (*OnEnter)() = nullptr, void (*OnState)() = nullptr,
+          void (*OnExit)() = nullptr>
+struct StaticState
+{
+  static void on_enter() { StaticCall<OnEnter>::run(); }
+  static void on_state() { StaticCall<OnState>::run(); }
+  static void on_exit() { StaticCall<OnExit>::run(); }
+};
+
+
+template <int I, class... States>
+struct StaticStateList
+{
+  static void on_enter(int) {}
+  static void on_state(int) {}
+  static void on_exit(int) {}
+};
+
+template <int I, class S, class... Rest>
+struct StaticStateList<I, S, Rest...>
+{
+  static void on_enter(int id)
+  {
+    if (id == I)
+      S::on_enter();
+    else
+      StaticStateList<I + 1, Rest...>::on_enter(id);
+  }
+
+  static void on_state(int id)
+  {
+    if (id == I)
+      S::on_state();
+    else
+      StaticStateList<I + 1, Rest...>::on_state(id);
+  }
+
+  static void on_exit(int id)
+  {
+    if (id == I)
+      S::on_exit();
+    else
+      StaticStateList<I + 1, Rest...>::on_exit(id);
+  }
+};
+
+template <class... States>
+struct StaticStates : StaticStateList<0, States...>
+{
+  static const int count = sizeof...(States);
+};
+
+
+template <int From, int To, int Event, void (*OnTransition)() = nullptr>
+struct StaticTransition
+{
+  static const int state_from = From;
+  static const int state_to = To;
+
+  static bool matches_event(int state, int event)
+  {
+    return state == From && event == Event;
+  }
+
+  static bool matches_timeout(int, unsigned long)
+  {
+    return false;
+  }
+
+  static void on_transition() { StaticCall<OnTransition>::run(); }
+};
+
+
+template <int From, int To, unsigned long Interval,
+          void (*OnTransition)() = nullptr>
+struct StaticTimedTransition
+{
+  static const int state_from = From;
+  static const int state_to = To;
+
+  static bool matches_event(int, int)
+  {
+    return false;
+  }
+
+  static bool matches_timeout(int state, unsigned long elapsed)
+  {
+    return state == From && elapsed >= Interval;
+  }
+
+  static void on_transition() { StaticCall<OnTransition>::run(); }
+};
+
+
+template <class... Transitions>
+struct TransitionTable
+{
+  static constexpr int max_state() { return 0; }
+
+  template <int State, class Machine>
+  static bool trigger_from(Machine&, int) { return false; }
+
+  template <int State, class Machine>
+  static bool check_timeout_from(Machine&, unsigned long) { return false; }
+};
+
+template <class T, class... Rest>
+struct TransitionTable<T, Rest...>
+{
+  typedef TransitionTable<Rest...> Next;
+
+  static constexpr int max_state()
+  {
+    return T::state_from > T::state_to
+        ? (T::state_from > Next::max_state() ? T::state_from
+                                             : Next::max_state())
+        : (T::state_to > Next::max_state() ? T::state_to
+                                           : Next::max_state());
+  }
+
+  // The entries of one state. The state is a constant, so entries from
+  // other states compile to nothing; the first matching entry wins, as with
+  // Fsm::add_transition().
+  template <int State, class Machine>
+  static bool trigger_from(Machine& fsm, int event)
+  {
+    if (T::state_from == State && T::matches_event(State, event))
+    {
+      fsm.make_transition(T::state_to, &T::on_transition);
+      return true;
+    }
+    return Next::template trigger_from<State>(fsm, event);
+  }
+
+  template <int State, class Machine>
+  static bool check_timeout_from(Machine& fsm, unsigned long elapsed)
+  {
+    if (T::state_from == State && T::matches_timeout(State, elapsed))
+    {
+      fsm.make_transition(T::state_to, &T::on_transition);
+      return true;
+    }
+    return Next::template check_timeout_from<State>(fsm, elapsed);
+  }
+};
+
+
+// Finds the current state among [Lo, Hi) by halving the range, then runs
+// the table entries of that state.
+template <class Table, int Lo, int Hi, bool Leaf = (Hi - Lo == 1)>
+struct StaticDispatch
+{
+  static const int mid = Lo + (Hi - Lo) / 2;
+
+  template <class Machine>
+  static bool trigger(Machine& fsm, int event)
+  {
+    if (fsm.m_current_state < mid)
+      return StaticDispatch<Table, Lo, mid>::trigger(fsm, event);
+    return StaticDispatch<Table, mid, Hi>::trigger(fsm, event);
+  }
+
+  template <class Machine>
+  static bool check_timeout(Machine& fsm, unsigned long elapsed)
+  {
+    if (fsm.m_current_state < mid)
+      return StaticDispatch<Table, Lo, mid>::check_timeout(fsm, elapsed);
+    return StaticDispatch<Table, mid, Hi>::check_timeout(fsm, elapsed);
+  }
+};
+
+template <class Table, int Lo, int Hi>
+struct StaticDispatch<Table, Lo, Hi, true>
+{
+  template <class Machine>
+  static bool trigger(Machine& fsm, int event)
+  {
+    return Table::template trigger_from<Lo>(fsm, event);
+  }
+
+  template <class Machine>
+  static bool check_timeout(Machine& fsm, unsigned long elapsed)
+  {
+    return Table::template check_timeout_from<Lo>(fsm, elapsed);
+  }
+};
+
+
+template <class States, class Transitions, int InitialState = 0>
+class StaticFsm
+{
+  static_assert(States::count <= 256, "StaticFsm supports up to 256 states");
+  static_assert(Transitions::max_state() < States::count,
+                "transition refers to an undefined state");
+  static_assert(InitialState >= 0 && InitialState < States::count,
+                "initial state is not defined");
+
+  typedef StaticDispatch<Transitions, 0, States::count> Dispatch;
+
+public:
+  StaticFsm()
+  : m_current_state(InitialState),
+    m_initialized(false),
+    m_start(0)
+  {
+  }
+
+  void trigger(int event)
+  {
+    if (m_initialized)
+      Dispatch::trigger(*this, event);
+  }
+
+  void check_timed_transitions()
+  {
+    Dispatch::check_timeout(*this, millis() - m_start);
+  }
+
+  void run_machine()
+  {
+    // first run must exec first state "on_enter"
+    if (!m_initialized)
+    {
+      m_initialized = true;
+      m_start = millis();
+      States::on_enter(m_current_state);
+    }
+
+    States::on_state(m_current_state);
+
+    check_timed_transitions();
+  }
+
+  int current_state() const
+  {
+    return m_current_state;
+  }
+
+private:
+  template <class... T> friend struct TransitionTable;
+  template <class T, int Lo, int Hi, bool Leaf> friend struct StaticDispatch;
+
+  void make_transition(int state_to, void (*on_transition)())
+  {
+    // Execute the handlers in the correct order.
+    States::on_exit(m_current_state);
+    on_transition();
+    States::on_enter(state_to);
+
+    m_current_state = state_to;
+    m_start = millis();
+  }
+
+private:
+  uint8_t m_current_state;
+  bool m_initialized;
+  unsigned long m_start;
+};
+
+
+#endif